@@ -0,0 +1,44 @@
+/*
+ * CLogger.cpp
+ */
+
+#include "CLogger.hpp"
+
+namespace mulog {
+
+mulog_level CLogger::level(Severity s) {
+	// the C levels are numbered like Severity
+	return static_cast<mulog_level>(static_cast<uint_fast8_t>(s));
+}
+
+// Each message is passed on with the caller's return address, so that its backtrace leaves this frame out
+
+void CLogger::issue(Severity s, const char * msg, std::size_t len) {
+	if(!will_issue(s)) return;
+	mulog_log_from(m_log, level(s), MULOG_CALLER, nullptr, mulog_enc_utf8, msg, len);
+}
+
+void CLogger::issue(Severity s, const std::string & msg) {
+	if(!will_issue(s)) return;
+	mulog_log_from(m_log, level(s), MULOG_CALLER, nullptr, mulog_enc_utf8, msg.data(), msg.size());
+}
+
+void CLogger::issue_format(Severity s, const char * fmt, const char * msg, std::size_t len) {
+	if(!will_issue(s)) return;
+	mulog_log_from(m_log, level(s), MULOG_CALLER, fmt, mulog_enc_utf8, msg, len);
+}
+
+void CLogger::issue(Severity s, const std::wstring & msg) {
+	if(!will_issue(s)) return;
+	// wchar_t is UTF-16 on Windows and UTF-32 elsewhere
+	mulog_log_from(m_log, level(s), MULOG_CALLER, nullptr, sizeof(wchar_t) == 2 ? mulog_enc_utf16 : mulog_enc_utf32, msg.data(), msg.size());
+}
+
+#if MULOG_FEATURE_QT
+void CLogger::issue(Severity s, const QString & msg) {
+	if(!will_issue(s)) return;
+	mulog_log_from(m_log, level(s), MULOG_CALLER, nullptr, mulog_enc_utf16, msg.utf16(), static_cast<std::size_t>(msg.size()));
+}
+#endif
+
+} /* namespace mulog */
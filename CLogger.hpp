@@ -0,0 +1,40 @@
+/*
+ * CLogger.hpp
+ *
+ *  A LoggerBase that writes through a C mulog logger, so C++ messages get exactly the same
+ *  header, timestamp and sinks as those logged with mulog_err() and friends.
+ */
+
+#ifndef MULOG_CLOGGER_HPP_
+#define MULOG_CLOGGER_HPP_
+
+#include "LoggerBase.hpp"
+#include "mulog.h"
+
+namespace mulog {
+
+class CLogger : public LoggerBase {
+	mulog_ref m_log;
+public:
+	// The C logger is not owned, and must outlive this object
+	explicit CLogger(mulog_ref log, Severity filter = Severity::VerboseDebug) : LoggerBase(filter), m_log(log) {}
+
+	mulog_ref handle() const { return m_log; }
+
+	using LoggerBase::issue;
+	virtual void issue(Severity s, const char * msg, std::size_t len);
+	virtual void issue(Severity s, const std::string & msg);
+	// Converted to UTF-8 by the C logger, straight into the record it writes
+	virtual void issue(Severity s, const std::wstring & msg);
+#if MULOG_FEATURE_QT
+	virtual void issue(Severity s, const QString & msg);
+#endif
+	// The format string is the message's category in a C column logger
+	virtual void issue_format(Severity s, const char * fmt, const char * msg, std::size_t len);
+
+	// The C API's level for a severity
+	static mulog_level level(Severity s);
+};
+
+} /* namespace mulog */
+#endif /* MULOG_CLOGGER_HPP_ */
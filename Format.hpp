@@ -0,0 +1,232 @@
+/*
+ * Format.hpp
+ *
+ *  Compile-time parsed format strings for LoggerBase::format().
+ *
+ *  A format string is given with MULOG_FMT("...") and uses "{}" for each argument, with
+ *  "{{" and "}}" standing for literal braces. It is split into literal segments at compile
+ *  time, so each call site gets an encoder that copies fixed-length literals and encodes
+ *  its arguments by type, into a buffer sized from a per-type upper bound. A malformed
+ *  string, an argument count that doesn't match, or an argument type without a formatter
+ *  is a compile error.
+ */
+
+#ifndef MULOG_FORMAT_HPP_
+#define MULOG_FORMAT_HPP_
+
+#include <mulog_config.hpp>
+
+#include <stdint.h>
+#include <charconv>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <type_traits>
+
+// Wraps a string literal so that LoggerBase::format() can parse it at compile time
+#define MULOG_FMT(str) \
+	([] { struct mulog_fmt_string { static constexpr const char * value() { return str; } }; return mulog_fmt_string(); }())
+
+namespace mulog {
+namespace format_detail {
+
+// Thrown while parsing a malformed format string; since parsing happens during constant
+// evaluation, this surfaces as a compile error pointing here
+struct FormatError {};
+
+// A run of literal text, optionally followed by an argument
+struct Segment {
+	std::size_t off;
+	std::size_t len;
+	bool arg;
+};
+
+template<std::size_t N>
+struct Segments {
+	Segment seg[N];
+	std::size_t args;
+	std::size_t literal;
+};
+
+constexpr std::size_t count_segments(const char * s) {
+	std::size_t n = 1;
+	for(std::size_t i = 0; s[i]; ++i) {
+		if(s[i] == '{' && (s[i + 1] == '{' || s[i + 1] == '}')) { ++n; ++i; }
+		else if(s[i] == '}' && s[i + 1] == '}') { ++n; ++i; }
+		else if(s[i] == '{' || s[i] == '}') throw FormatError(); // unmatched brace in format string
+	}
+	return n;
+}
+
+template<std::size_t N>
+constexpr Segments<N> parse(const char * s) {
+	Segments<N> r{};
+	std::size_t k = 0, start = 0, i = 0;
+	for(; s[i]; ++i) {
+		if(s[i] != '{' && s[i] != '}') continue;
+		// "{}" ends the segment before the argument; "{{" and "}}" keep one brace as literal text
+		const bool arg = s[i] == '{' && s[i + 1] == '}';
+		r.seg[k].off = start;
+		r.seg[k].len = i - start + (arg ? 0 : 1);
+		r.seg[k].arg = arg;
+		r.literal += r.seg[k].len;
+		r.args += arg ? 1 : 0;
+		++k;
+		start = i + 2;
+		++i;
+	}
+	r.seg[k].off = start;
+	r.seg[k].len = i - start;
+	r.seg[k].arg = false;
+	r.literal += r.seg[k].len;
+	return r;
+}
+
+template<class T> struct always_false : std::false_type {};
+
+// Argument formatters: bound() is an upper limit on the bytes encode() writes
+template<class T, class Enable = void>
+struct Arg {
+	static_assert(always_false<T>::value, "mulog: no formatter for this argument type");
+};
+
+template<class T>
+struct Arg<T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value && !std::is_same<T, char>::value>::type> {
+	static constexpr std::size_t max = std::numeric_limits<T>::digits10 + 2;
+	static std::size_t bound(T) { return max; }
+	static char * encode(char * out, T v) {
+		typedef typename std::make_unsigned<T>::type U;
+		const bool neg = std::is_signed<T>::value && v < T(0);
+		U u = neg ? U(U(0) - U(v)) : U(v);
+		char tmp[max];
+		char * p = tmp + max;
+		do {
+			*--p = static_cast<char>('0' + u % 10);
+			u /= 10;
+		} while(u);
+		if(neg) *--p = '-';
+		const std::size_t n = static_cast<std::size_t>(tmp + max - p);
+		std::memcpy(out, p, n);
+		return out + n;
+	}
+};
+
+template<class T>
+struct Arg<T, typename std::enable_if<std::is_floating_point<T>::value>::type> {
+	// "-d.ddddde+XXXX": sign, 6 significant digits and point, exponent up to long double's
+	static constexpr std::size_t max = 14;
+	static std::size_t bound(T) { return max; }
+	static char * encode(char * out, T v) {
+		// same rendering as printf's %g, without parsing a format string at run time
+		return std::to_chars(out, out + max, v, std::chars_format::general, 6).ptr;
+	}
+};
+
+template<>
+struct Arg<bool> {
+	static std::size_t bound(bool) { return 5; }
+	static char * encode(char * out, bool v) {
+		std::memcpy(out, v ? "true" : "false", v ? 4 : 5);
+		return out + (v ? 4 : 5);
+	}
+};
+
+template<>
+struct Arg<char> {
+	static std::size_t bound(char) { return 1; }
+	static char * encode(char * out, char v) {
+		*out = v;
+		return out + 1;
+	}
+};
+
+template<>
+struct Arg<const char *> {
+	static std::size_t bound(const char * v) { return v ? std::strlen(v) : 6; }
+	static char * encode(char * out, const char * v) {
+		if(!v) v = "(null)";
+		const std::size_t n = std::strlen(v);
+		std::memcpy(out, v, n);
+		return out + n;
+	}
+};
+
+template<>
+struct Arg<char *> : Arg<const char *> {};
+
+template<>
+struct Arg<std::string> {
+	static std::size_t bound(const std::string & v) { return v.size(); }
+	static char * encode(char * out, const std::string & v) {
+		std::memcpy(out, v.data(), v.size());
+		return out + v.size();
+	}
+};
+
+template<class T>
+struct Arg<T *, typename std::enable_if<!std::is_same<typename std::remove_cv<T>::type, char>::value>::type> {
+	static std::size_t bound(const T *) { return 2 + 2 * sizeof(void *); }
+	static char * encode(char * out, const T * v) {
+		uintptr_t u = reinterpret_cast<uintptr_t>(v);
+		*out++ = '0';
+		*out++ = 'x';
+		for(int shift = 4 * 2 * sizeof(void *) - 4; shift >= 0; shift -= 4) *out++ = "0123456789abcdef"[(u >> shift) & 0xF];
+		return out;
+	}
+};
+
+inline std::size_t sum() { return 0; }
+template<class... REST>
+std::size_t sum(std::size_t first, REST... rest) { return first + sum(rest...); }
+
+// The encoder for one call site: FMT is the type made by MULOG_FMT, ARGS the decayed argument types
+template<class FMT, class... ARGS>
+struct Format {
+	static constexpr std::size_t nsegs = count_segments(FMT::value());
+	static constexpr Segments<nsegs> segs = parse<nsegs>(FMT::value());
+	static_assert(segs.args == sizeof...(ARGS), "mulog: format string and argument count differ");
+
+	static std::size_t bound(const ARGS & ... args) { return segs.literal + sum(Arg<ARGS>::bound(args)...); }
+	static char * encode(char * out, const ARGS & ... args) { return put<0>(out, args...); }
+
+private:
+	template<std::size_t I>
+	static char * literal(char * out) {
+		constexpr std::size_t off = segs.seg[I].off;
+		constexpr std::size_t len = segs.seg[I].len;
+		std::memcpy(out, FMT::value() + off, len);
+		return out + len;
+	}
+
+	// all arguments consumed: the remaining segments are literal
+	template<std::size_t I>
+	static typename std::enable_if<(I < nsegs), char *>::type put(char * out) {
+		return put<I + 1>(literal<I>(out));
+	}
+	template<std::size_t I>
+	static typename std::enable_if<(I >= nsegs), char *>::type put(char * out) { return out; }
+
+	template<std::size_t I, class A, class... REST>
+	static char * put(char * out, const A & a, const REST & ... rest) {
+		return next<I>(std::integral_constant<bool, segs.seg[I].arg>(), literal<I>(out), a, rest...);
+	}
+
+	template<std::size_t I, class A, class... REST>
+	static char * next(std::true_type, char * out, const A & a, const REST & ... rest) {
+		return put<I + 1>(Arg<A>::encode(out, a), rest...);
+	}
+	template<std::size_t I, class... REST>
+	static char * next(std::false_type, char * out, const REST & ... rest) {
+		return put<I + 1>(out, rest...);
+	}
+};
+
+template<class FMT, class... ARGS>
+constexpr std::size_t Format<FMT, ARGS...>::nsegs;
+template<class FMT, class... ARGS>
+constexpr Segments<Format<FMT, ARGS...>::nsegs> Format<FMT, ARGS...>::segs;
+
+} /* namespace format_detail */
+} /* namespace mulog */
+#endif /* MULOG_FORMAT_HPP_ */
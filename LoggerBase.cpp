@@ -6,17 +6,29 @@
  */
 
 #include "LoggerBase.hpp"
+#include "Transcode.hpp"
+#include "mulog.h"
 
 namespace mulog {
 
+void LoggerBase::issue(Severity s, const std::wstring & msg) {
+	std::size_t cap;
+	char * rec = mulog_rec_acquire(utf8_boundw(msg.size()), &cap);
+	if(!rec) return;
+	issue(s, rec, wide_to_utf8(msg.data(), msg.size(), rec, cap));
+	mulog_rec_release(rec);
+}
+
 #if MULOG_FEATURE_QT
 void LoggerBase::issue(Severity s, const QString & msg) {
-#if MULOG_OS_WINDOWS
-	issue(s, msg.toStdWString());
-#else
-	issue(s, msg.toStdString());
-#endif
+	const std::size_t len = static_cast<std::size_t>(msg.size());
+	std::size_t cap;
+	char * rec = mulog_rec_acquire(utf8_bound16(len), &cap);
+	if(!rec) return;
+	issue(s, rec, utf16_to_utf8(reinterpret_cast<const uint16_t *>(msg.utf16()), len, rec, cap));
+	mulog_rec_release(rec);
 }
+#endif
 
 LoggerBase::~LoggerBase() {
 	// TODO Auto-generated destructor stub
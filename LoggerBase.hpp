@@ -9,10 +9,15 @@
 #define MULOG_LOGGER_HPP_
 
 #include <mulog_config.hpp>
+#include "Format.hpp"
+#include "mulog.h"
 
 #include <stdint.h>
+#include <cstddef>
+#include <cstring>
 #include <string>
 #include <ostream>
+#include <type_traits>
 
 #if MULOG_FEATURE_QT
 #include <QtCore/QString>
@@ -38,16 +43,64 @@ constexpr bool isActive(Severity requested, Severity filter) { return static_cas
 class LoggerBase {
 	Severity m_filter;
 public:
+	explicit LoggerBase(Severity filter = Severity::VerboseDebug) : m_filter(filter) {}
+
 	Severity severity() const { return m_filter; }
 	void set_severity(Severity val) { m_filter = val; }
 	bool will_issue(Severity requested) const { return isActive(requested, m_filter); }
 
 	// Basic calls
-	virtual void issue(Severity s, const std::string & msg) = 0;
-	virtual void issue(Severity s, const std::wstring & msg) = 0;
+	// The (const char *, size_t) overload must not allocate, so that a sink built on
+	// the C record pool can be used from threads where malloc is forbidden
+	virtual void issue(Severity s, const char * msg, std::size_t len) = 0;
+	void issue(Severity s, const char * msg) { issue(s, msg, std::strlen(msg)); }
+	virtual void issue(Severity s, const std::string & msg) { issue(s, msg.data(), msg.size()); }
+	// Wide and Qt strings are transcoded to UTF-8 in a pooled record buffer, without allocating
+	virtual void issue(Severity s, const std::wstring & msg);
 #if MULOG_FEATURE_QT
 	virtual void issue(Severity s, const QString & msg);
 #endif
+	// A format() message, with the format string it was built from, which identifies the call site
+	// for sinks that group messages by it; by default the format string is dropped
+	virtual void issue_format(Severity s, const char * fmt, const char * msg, std::size_t len) { issue(s, msg, len); }
+
+	// Type-checked formatting, with the format string parsed at compile time (see Format.hpp)
+	// e.g. log.format(Severity::Info, MULOG_FMT("{} of {} done"), n, total);
+	// The message is encoded into a pooled record buffer and passed to issue_format()
+	template<class FMT, class... ARGS>
+	void format(Severity s, FMT, const ARGS & ... args) {
+		typedef format_detail::Format<FMT, typename std::decay<const ARGS>::type...> Encoder;
+		if(!will_issue(s)) return;
+		char * rec = mulog_rec_acquire(Encoder::bound(args...), nullptr);
+		if(!rec) return;
+		issue_format(s, FMT::value(), rec, static_cast<std::size_t>(Encoder::encode(rec, args...) - rec));
+		mulog_rec_release(rec);
+	}
+
+	// Pushes a field onto the calling thread's log context (see mulog_ctx_push) for its lifetime
+	// e.g. LoggerBase::Scope request("req", id.c_str());
+	class Scope {
+	public:
+		Scope(const char * key, const char * value) { mulog_ctx_push(key, value); }
+		explicit Scope(const char * value) : Scope(nullptr, value) {}
+		Scope(const std::string & key, const std::string & value) : Scope(key.c_str(), value.c_str()) {}
+		~Scope() { mulog_ctx_pop(); }
+		Scope(const Scope &) = delete;
+		Scope & operator=(const Scope &) = delete;
+	};
+
+	// For sinks that keep context fields apart from the message: calls
+	// f(key, key_len, value, value_len) for each field of the calling thread's context, outermost first
+	template<class F>
+	static void context(F f) {
+		const std::size_t n = mulog_ctx_count();
+		for(std::size_t i = 0; i < n; ++i) {
+			const char * k;
+			const char * v;
+			std::size_t kl, vl;
+			if(mulog_ctx_field(i, &k, &kl, &v, &vl) == mulog_ok) f(k, kl, v, vl);
+		}
+	}
 
 	// C++ ostream formatting
 	//std::ostream & issue(Severity s);
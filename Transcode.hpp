@@ -0,0 +1,45 @@
+/*
+ * Transcode.hpp
+ *
+ *  Allocation-free UTF-16 and UTF-32 to UTF-8 conversion, used to feed QString and
+ *  std::wstring messages into the UTF-8 issue() overload. The converters are the C library's
+ *  (mulog_utf16_to_utf8), which CLogger also has convert messages directly into their records.
+ */
+
+#ifndef MULOG_TRANSCODE_HPP_
+#define MULOG_TRANSCODE_HPP_
+
+#include <mulog_config.hpp>
+#include "mulog.h"
+
+#include <stdint.h>
+#include <cstddef>
+
+namespace mulog {
+
+// Maximum number of UTF-8 bytes produced by len UTF-16 or UTF-32 code units
+constexpr std::size_t utf8_bound16(std::size_t len) { return len * 3; }
+constexpr std::size_t utf8_bound32(std::size_t len) { return len * 4; }
+
+// Convert len code units at src to UTF-8 at dst, writing at most cap bytes
+// Unpaired surrogates and invalid code points become U+FFFD; if dst is too small, output
+// stops at the last whole character that fits. Returns the number of bytes written.
+inline std::size_t utf16_to_utf8(const uint16_t * src, std::size_t len, char * dst, std::size_t cap) {
+	return mulog_utf16_to_utf8(src, len, dst, cap);
+}
+inline std::size_t utf32_to_utf8(const uint32_t * src, std::size_t len, char * dst, std::size_t cap) {
+	return mulog_utf32_to_utf8(src, len, dst, cap);
+}
+
+// wchar_t is UTF-16 on Windows and UTF-32 elsewhere
+inline std::size_t utf8_boundw(std::size_t len) {
+	return sizeof(wchar_t) == 2 ? utf8_bound16(len) : utf8_bound32(len);
+}
+inline std::size_t wide_to_utf8(const wchar_t * src, std::size_t len, char * dst, std::size_t cap) {
+	return sizeof(wchar_t) == 2
+		? utf16_to_utf8(reinterpret_cast<const uint16_t *>(src), len, dst, cap)
+		: utf32_to_utf8(reinterpret_cast<const uint32_t *>(src), len, dst, cap);
+}
+
+} /* namespace mulog */
+#endif /* MULOG_TRANSCODE_HPP_ */
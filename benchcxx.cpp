@@ -0,0 +1,75 @@
+/*
+ * benchcxx.cpp
+ *
+ *  Times one message, end to end, through a C file logger writing to /dev/null: formatted
+ *  with mulog_info() (vsnprintf), with LoggerBase::format() through a CLogger, and, for
+ *  scale, with fprintf straight to the file. Also times format() into a sink that discards
+ *  the message, which is the cost of encoding alone.
+ *  Usage: benchcxx [messages]
+ */
+
+#include "LoggerBase.hpp"
+#include "CLogger.hpp"
+#include "mulog.h"
+
+#include <stdint.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace mulog;
+
+namespace {
+
+class Discard : public LoggerBase {
+public:
+	using LoggerBase::issue;
+	void issue(Severity, const char *, std::size_t) override {}
+};
+
+template<class F>
+double time_ns(long n, F f) {
+	const auto start = std::chrono::steady_clock::now();
+	for(long i = 0; i < n; ++i) f(i);
+	const auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::nano>(end - start).count() / n;
+}
+
+} // namespace
+
+int main(int argc, char ** argv) {
+	const long n = argc > 1 ? std::atol(argv[1]) : 1000000;
+	const char * user = "alice";
+	const uint64_t bytes = 1234567890123ull;
+	FILE * f = std::fopen("/dev/null", "w");
+	mulog_ref l;
+
+	if(!f || n <= 0) return 1;
+	mulog_pool_init(256, 32, 4, 4096, 2);
+	mulog_create_file(&l, f, mulog_tm_fixed, 1);
+	CLogger log(l);
+	Discard discard;
+
+	const double tfprintf = time_ns(n, [&](long i) {
+		std::fprintf(f, "request %ld from %s sent %llu bytes\n", i, user, static_cast<unsigned long long>(bytes));
+	});
+	const double tc = time_ns(n, [&](long i) {
+		mulog_info(l, "request %ld from %s sent %llu bytes", i, user, static_cast<unsigned long long>(bytes));
+	});
+	const double tformat = time_ns(n, [&](long i) {
+		log.format(Severity::Info, MULOG_FMT("request {} from {} sent {} bytes"), i, user, bytes);
+	});
+	const double tencode = time_ns(n, [&](long i) {
+		discard.format(Severity::Info, MULOG_FMT("request {} from {} sent {} bytes"), i, user, bytes);
+	});
+
+	std::printf("%ld messages, ns per message:\n", n);
+	std::printf("  fprintf (no header)        %7.1f\n", tfprintf);
+	std::printf("  mulog_info                 %7.1f\n", tc);
+	std::printf("  CLogger format             %7.1f\n", tformat);
+	std::printf("  format, encoding only      %7.1f\n", tencode);
+
+	mulog_destroy(l);
+	std::fclose(f);
+	return 0;
+}
@@ -22,11 +22,139 @@
  */
 
 #include "mulog.h"
+#include "mulog_col.h"
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef MULOG_UNIX
+#include <pthread.h>
+#endif
+
+#ifdef MULOG_TEST_NOALLOC
+/* Counts heap allocations made while armed, to check that logging doesn't allocate once warmed up */
+extern void *__libc_malloc(size_t n);
+extern void *__libc_calloc(size_t n, size_t sz);
+extern void *__libc_realloc(void *p, size_t n);
+
+static int na_armed = 0;
+static unsigned long na_count = 0;
+
+void *malloc(size_t n) {
+    if(na_armed) na_count++;
+    return __libc_malloc(n);
+}
+void *calloc(size_t n, size_t sz) {
+    if(na_armed) na_count++;
+    return __libc_calloc(n, sz);
+}
+void *realloc(void *p, size_t n) {
+    if(na_armed) na_count++;
+    return __libc_realloc(p, n);
+}
+#endif
+
+static char arena[1024];
+static char large[300];
+
+void logall(mulog_ref *all) {
+    for(int i = 0; i < 6; i++) {
+        printf("log %d\n", i);
+        mulog_err(all[i], "mulog_err %d", i);
+        mulog_warn(all[i], "mulog_warn %d", i);
+        mulog_info(all[i], "mulog_info %d", i);
+        mulog_dbg(all[i], "mulog_dbg %d", i);
+        mulog_log(all[i], mulog_l_vinfo, "mulog_log vinfo %d", i);
+        mulog_log(all[i], mulog_l_critical, "mulog_log critical %d", i);
+        mulog_info(all[i], "mulog_info large %s", large);
+    }
+}
+
+/* Log an error through the variadic and the preformatted entry points; the backtraces must
+ * start in these functions (the flush keeps the logging calls from being tail calls)
+ */
+__attribute__((noinline)) void trace_err(mulog_ref l) {
+    mulog_err(l, "traced mulog_err");
+    mulog_flush(l);
+}
+__attribute__((noinline)) void trace_msg(mulog_ref l) {
+    mulog_log_msg(l, mulog_l_error, "traced mulog_log_msg", 20);
+    mulog_flush(l);
+}
+
+#ifdef MULOG_UNIX
+/* Releases records acquired by another thread, then exits */
+void *release_recs(void *recs) {
+    for(int i = 0; i < 6; i++) {
+        mulog_rec_release(((char **)recs)[i]);
+    }
+    return NULL;
+}
+
+#define STRESS_THREADS 4
+#define STRESS_MSGS 2000
+
+static mulog_ref stress_log;
+static int stress_done = 0;
+
+/* Logs errors, which pass any level the swapper sets, to the split logger */
+void *stress_logger(void *arg) {
+    int t = (int)(intptr_t)arg;
+    for(int i = 0; i < STRESS_MSGS; i++) {
+        mulog_err(stress_log, "stress %d %d", t, i);
+    }
+    return NULL;
+}
+
+/* Until the loggers are done, swaps the left logger's file and settings, and replaces the
+ * right logger, destroying the one it replaced; returns the number of right loggers replaced
+ */
+void *stress_swapper(void *files) {
+    FILE **f = files;
+    mulog_ref left = mulog_get_left(stress_log), right, old;
+    uintptr_t replaced = 0;
+    for(unsigned n = 0; !__atomic_load_n(&stress_done, __ATOMIC_ACQUIRE); n++) {
+        mulog_set_file(left, f[n & 1]);
+        mulog_set_level(stress_log, (mulog_level)(n % (mulog_l_error + 1)));
+        mulog_set_level(left, (mulog_level)((n + 3) % (mulog_l_error + 1)));
+        mulog_set_timefmt(left, (mulog_timefmt)(n % mulog_tm_na));
+        mulog_set_with_debug(left, n & 1);
+        if(mulog_create_file(&right, f[2], (mulog_timefmt)(n % mulog_tm_na), n & 1) != mulog_ok) continue;
+        old = mulog_get_right(stress_log);
+        if(mulog_set_right(stress_log, right) == mulog_ok) {
+            mulog_destroy(old);
+            replaced++;
+        } else {
+            mulog_destroy(right);
+        }
+    }
+    return (void *)replaced;
+}
+
+// counts the lines in f, and those that aren't a whole stress message
+static int stress_lines(FILE *f, int *bad) {
+    char line[256];
+    int n = 0;
+    fflush(f);
+    rewind(f);
+    while(fgets(line, sizeof(line), f)) {
+        size_t len = strlen(line);
+        int t, i;
+        n++;
+        if(!len || line[len - 1] != '\n' || !strstr(line, "] ERROR: stress ")
+           || sscanf(strstr(line, "stress "), "stress %d %d", &t, &i) != 2) (*bad)++;
+    }
+    return n;
+}
+#endif
 
 int main(int argc, char **argv) {
     mulog_ref mlf, mlfp, mlc, mlcp, mls, dummy;
     mulog_ref all[6];
 
+    memset(large, '=', sizeof(large) - 1);
+    mulog_pool_init(256, 32, 4, 4096, 2);
+    mulog_arena_init(arena, sizeof(arena));
+
     FILE *f = fopen("banana.log", "w");
     mulog_create_file(&mlf, f, mulog_tm_long, 1);
     mulog_create_file(&mlfp, f, mulog_tm_short, 0);
@@ -47,6 +175,7 @@ int main(int argc, char **argv) {
         printf("%d[type]: %d\n", i, mulog_get_type(all[i]));
         printf("%d[file]: %p\n", i, mulog_get_file(all[i]));
         printf("%d[wdbg]: %d\n", i, mulog_get_with_debug(all[i]));
+        printf("%d[levl]: %d\n", i, mulog_get_level(all[i]));
         printf("%d[wclr]: %d\n", i, mulog_get_with_color(all[i]));
         printf("%d[left]: %p\n", i, mulog_get_left(all[i]));
         printf("%d[rite]: %p\n", i, mulog_get_right(all[i]));
@@ -59,17 +188,187 @@ int main(int argc, char **argv) {
         putchar('\n');
     };
 
+    mulog_trace_start(8, f);
+
     puts("\n=== Logging ===\n");
-    for(int i = 0; i < 6; i++) {
-        printf("log %d\n", i);
-        mulog_err(all[i], "mulog_err %d", i);
-        mulog_warn(all[i], "mulog_warn %d", i);
-        mulog_info(all[i], "mulog_info %d", i);
-        mulog_dbg(all[i], "mulog_dbg %d", i);
+    logall(all);
+
+    puts("\n=== Logging (with context) ===\n");
+    mulog_ctx_push("req", "42");
+    mulog_ctx_push(NULL, "worker-1");
+    logall(all);
+    mulog_ctx_pop();
+    mulog_ctx_pop();
+
+#ifdef MULOG_TEST_NOALLOC
+    puts("\n=== Logging (allocation check) ===\n");
+    // segments of a few records, so that they fill up and are written while armed
+    FILE *naf = tmpfile();
+    mulog_ref nacol;
+    mulog_create_col(&nacol, naf, 4, 1);
+    mulog_info(nacol, "warm-up");
+    mulog_flush(nacol);
+    na_armed = 1;
+    logall(all);
+    mulog_ctx_push("req", "na");
+    for(int i = 0; i < 10; i++) {
+        mulog_info(nacol, "mulog_info col %d", i);
+        mulog_info(nacol, "mulog_info col large %s", large);
     }
+    mulog_ctx_pop();
+    mulog_info(nacol, "%5000d", 0);
+    mulog_log_msg(nacol, mulog_l_error, "mulog_log_msg col", 17);
+    mulog_flush(nacol);
+    na_armed = 0;
+    mulog_destroy(nacol);
+    fclose(naf);
+#endif
+
+    mulog_trace_stop();
+
+    puts("\n=== Backtraces without output ===\n");
+    char ctx[480];
+    memset(ctx, 'c', sizeof(ctx) - 1);
+    ctx[sizeof(ctx) - 1] = '\0';
+    mulog_trace_start(8, NULL);
+    mulog_err(mlc, "raw backtrace");
+    mulog_ctx_push(NULL, ctx);
+    mulog_err(mlc, "raw backtrace, cut short to fit the context");
+    mulog_ctx_pop();
+    mulog_trace_stop();
 
     for(int i = 0; i < 6; i++) {
         mulog_destroy(all[i]);
     }
-    return 0;
+
+    int failed = 0;
+    puts("\n=== Backtraces start at the caller ===\n");
+    FILE *tf = tmpfile();
+    mulog_ref mlt;
+    mulog_create_file(&mlt, tf, mulog_tm_short, 0);
+    if(mulog_trace_start(4, tf) == mulog_ok) {
+        const char *want[2] = { "(trace_err+", "(trace_msg+" };
+        char line[512];
+        int top = 0;
+        trace_err(mlt);
+        trace_msg(mlt);
+        mulog_trace_stop();
+        rewind(tf);
+        // the innermost frame of each symbolized trace
+        while(fgets(line, sizeof(line), tf)) {
+            if(strncmp(line, "[bt=", 4) || !strstr(line, "] #0 ")) continue;
+            printf("%s", line);
+            if(top >= 2 || !strstr(line, want[top])) failed = 1;
+            top++;
+        }
+        if(top != 2) failed = 1;
+        printf("first frames: %s\n", failed ? "wrong" : "the callers'");
+    }
+    mulog_destroy(mlt);
+    fclose(tf);
+
+    puts("\n=== Columnar segments ===\n");
+    FILE *cf = tmpfile();
+    mulog_ref mlcol;
+    mulog_create_col(&mlcol, cf, 4, 0);
+    mulog_ctx_push("req", "7");
+    for(int i = 0; i < 10; i++) {
+        mulog_log(mlcol, (mulog_level)(i % 8), "mulog_log col %d", i);
+    }
+    mulog_ctx_pop();
+    mulog_log_msg(mlcol, mulog_l_error, "mulog_log_msg col", 17);
+    mulog_log_from(mlcol, mulog_l_error, MULOG_CALLER, "keyed %s", mulog_enc_utf8, "mulog_log_from col", 18);
+    // longer than a segment's payload bytes, so it goes in a segment of its own, truncated
+    mulog_info(mlcol, "%5000d", 1);
+    mulog_destroy(mlcol);
+
+    size_t csize = (size_t)ftell(cf), cpos = 0;
+    char *cbuf = malloc(csize);
+    const char *seg;
+    rewind(cf);
+    if(cbuf && fread(cbuf, 1, csize, cf) == csize) {
+        while((seg = mulog_col_next(cbuf, csize, &cpos))) {
+            const mulog_col_footer *cft = mulog_col_footer_of(seg);
+            printf("segment: %u records, levels %#x (%u-%u)\n", cft->count, cft->levels, cft->level_min, cft->level_max);
+            for(uint32_t i = 0; i < cft->count; i++) {
+                size_t len, clen;
+                const char *pay = mulog_col_payload(seg, i, &len);
+                const char *ctx = mulog_col_context(seg, i, &clen);
+                if(len > 80) {
+                    printf("  %u [%s] (%.*s) %zu bytes\n", mulog_col_levels(seg)[i],
+                           mulog_col_category(seg, mulog_col_cats(seg)[i]), (int)clen, ctx, len);
+                    if(len != 4095 || cft->count != 1) failed = 1;
+                    continue;
+                }
+                printf("  %u [%s] (%.*s) %.*s\n", mulog_col_levels(seg)[i], mulog_col_category(seg, mulog_col_cats(seg)[i]),
+                       (int)clen, ctx, (int)len, pay);
+            }
+        }
+    }
+    free(cbuf);
+    fclose(cf);
+
+#ifdef MULOG_UNIX
+    puts("\n=== Records released by another thread ===\n");
+    char *recs[32];
+    pthread_t rel;
+    unsigned long heap = mulog_pool_heap_allocs();
+    for(int i = 0; i < 6; i++) {
+        recs[i] = mulog_rec_acquire(1, NULL);
+    }
+    pthread_create(&rel, NULL, release_recs, recs);
+    pthread_join(rel, NULL);
+    // all 32 records must be back in the pool, none left in the exited thread's cache
+    for(int i = 0; i < 32; i++) {
+        recs[i] = mulog_rec_acquire(1, NULL);
+    }
+    for(int i = 0; i < 32; i++) {
+        mulog_rec_release(recs[i]);
+    }
+    int lost = mulog_pool_heap_allocs() != heap;
+    printf("records lost with the releasing thread: %s\n", lost ? "yes" : "none");
+    if(lost) failed = 1;
+
+    puts("\n=== Logging while loggers are reconfigured and destroyed ===\n");
+    FILE *sf[3] = { tmpfile(), tmpfile(), tmpfile() };
+    pthread_t slog[STRESS_THREADS], sswap;
+    mulog_ref sleft, sright;
+    void *replaced;
+    int slines, srlines, sbad = 0;
+    mulog_create_file(&sleft, sf[0], mulog_tm_long, 0);
+    mulog_create_file(&sright, sf[2], mulog_tm_long, 0);
+    mulog_create_split(&stress_log, sleft, sright);
+    pthread_create(&sswap, NULL, stress_swapper, sf);
+    for(int i = 0; i < STRESS_THREADS; i++) {
+        pthread_create(&slog[i], NULL, stress_logger, (void *)(intptr_t)i);
+    }
+    for(int i = 0; i < STRESS_THREADS; i++) {
+        pthread_join(slog[i], NULL);
+    }
+    __atomic_store_n(&stress_done, 1, __ATOMIC_RELEASE);
+    pthread_join(sswap, &replaced);
+    sright = mulog_get_right(stress_log);
+    mulog_destroy(stress_log);
+    mulog_destroy(sleft);
+    mulog_destroy(sright);
+    // every message reaches one of the left logger's files, and the right loggers' shared one
+    slines = stress_lines(sf[0], &sbad) + stress_lines(sf[1], &sbad);
+    srlines = stress_lines(sf[2], &sbad);
+    printf("left: %d lines, right: %d lines, %d malformed, of %d messages; %lu right loggers replaced\n",
+           slines, srlines, sbad, STRESS_THREADS * STRESS_MSGS, (unsigned long)(uintptr_t)replaced);
+    if(slines != STRESS_THREADS * STRESS_MSGS || srlines != STRESS_THREADS * STRESS_MSGS || sbad) {
+        puts("messages lost or torn while reconfiguring");
+        failed = 1;
+    }
+    for(int i = 0; i < 3; i++) {
+        fclose(sf[i]);
+    }
+#endif
+
+    printf("\npool heap allocations: %lu\n", mulog_pool_heap_allocs());
+#ifdef MULOG_TEST_NOALLOC
+    printf("heap allocations while logging: %lu\n", na_count);
+    if(na_count) return 1;
+#endif
+    return failed;
 }
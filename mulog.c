@@ -21,15 +21,52 @@
  * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#ifdef MULOG_UNIX
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE     // for dladdr
+#endif
+
 #include "mulog.h"
+#include "mulog_shm.h"
+#include "mulog_col.h"
 
 #include <time.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
+#include <limits.h>
 #ifdef MULOG_WIN32
 #include <WinCon.h>
 #endif
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#define MULOG_UTF8_SSE2 1
+#else
+#define MULOG_UTF8_SSE2 0
+#endif
+#ifdef MULOG_UNIX
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __GLIBC__
+#include <stdio_ext.h>
+#include <execinfo.h>
+#include <dlfcn.h>
+#include <link.h>
+#define MULOG_TRACE 1
+#endif
+#endif
+#ifndef MULOG_TRACE
+#define MULOG_TRACE 0
+#endif
 
 /* =====================
  * Console color helpers
@@ -60,40 +97,25 @@ HANDLE mulog_hstdout = 0;
 HANDLE mulog_hstderr = 0;
 #endif
     
-void Win32ConClrSet(FILE *f, Win32ConsoleColor fg, Win32ConsoleColor bg) {
+static void Win32ConClrSet(FILE *f, Win32ConsoleColor fg, Win32ConsoleColor bg) {
 #ifdef MULOG_WIN32
     if(f == stdout) SetConsoleTextAttribute(mulog_hstdout, bg | fg);
     else if(f == stderr) SetConsoleTextAttribute(mulog_hstderr, bg | fg);
 #endif
 }
 
-void Win32ConClrReset(FILE *f) {
+static void Win32ConClrReset(FILE *f) {
 #ifdef MULOG_WIN32
     Win32ConClrSet(f, wfg_grey, wbg_black);
 #endif
 }
 
-enum UnixConsoleColor {
-    u_none = -1,
-    u_black = 0, u_red,
-    u_green,     u_yellow,
-    u_blue,      u_magenta,
-    u_cyan,      u_white
-};
-typedef enum UnixConsoleColor UnixConsoleColor;
-
-void UnixConClrSet(FILE *f, UnixConsoleColor fg, int fgbright, UnixConsoleColor bg, int bgbright) {
-#ifdef MULOG_UNIX
-    if(fg != u_none) fprintf(f, "\x1B[%d;%dm", (fgbright ? 1 :22), (30+fg));
-    if(bg != u_none) fprintf(f, "\x1B[%d;%dm", (bgbright ? 1 : 22), (40 + bg));
-#endif
-}
-
-void UnixConClrReset(FILE *f) {
-#ifdef MULOG_UNIX
-    fputs("\x1b[0m", f);
-#endif
-}
+/* Precomputed ANSI escape sequences (bright foreground on default background) */
+static const char mulog_uc_red[] = "\x1B[1;31m";
+static const char mulog_uc_magenta[] = "\x1B[1;35m";
+static const char mulog_uc_cyan[] = "\x1B[1;36m";
+static const char mulog_uc_white[] = "\x1B[1;37m";
+static const char mulog_uc_reset[] = "\x1B[0m";
 
 /* =============
  * Instance data
@@ -101,365 +123,2282 @@ void UnixConClrReset(FILE *f) {
  */
 
 enum mulog_flg {
-    mulog_f_wdbg = 0x1,
     mulog_f_wclr = 0x2
 };
 typedef enum mulog_flg mulog_flg;
 
-struct mulog_t {
-    mulog_type type;
+/* Lock for the paths that may have to wait: pool setup, configuration writers and column
+ * loggers (the record and logger free lists don't take it)
+ * On Unix it is a priority-inheritance mutex, so a realtime thread that waits for it lends
+ * its priority to the holder instead of spinning while a lower-priority holder can't run.
+ */
+#ifdef MULOG_UNIX
+typedef pthread_mutex_t mulog_lock;
+
+static void lock_init(mulog_lock *lock) {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+    pthread_mutex_init(lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+static void pool_lock(mulog_lock *lock) {
+    pthread_mutex_lock(lock);
+}
+
+static void pool_unlock(mulog_lock *lock) {
+    pthread_mutex_unlock(lock);
+}
+
+static void lock_destroy(mulog_lock *lock) {
+    pthread_mutex_destroy(lock);
+}
+#else
+typedef unsigned char mulog_lock;
+
+static void lock_init(mulog_lock *lock) {
+    *lock = 0;
+}
+
+static void pool_lock(mulog_lock *lock) {
+    while(__atomic_test_and_set(lock, __ATOMIC_ACQUIRE));
+}
+
+static void pool_unlock(mulog_lock *lock) {
+    __atomic_clear(lock, __ATOMIC_RELEASE);
+}
+
+static void lock_destroy(mulog_lock *lock) {
+    (void)lock;
+}
+#endif
+
+struct mulog_idx {
+    FILE *fh;
+    size_t every;
+    size_t bytes;               // bytes logged in the current block
+    mulog_idx_entry ent;        // the current block; ent.levels == 0 while none is open
+};
+
+/* A logger's configuration
+ * Once published a snapshot is never modified: the set_ functions publish a modified copy and
+ * free the old one when no message that may be using it is still in progress (see below).
+ */
+struct mulog_cfg {
     mulog_timefmt timefmt;
     mulog_flg flag;
     FILE *fh;
     mulog_ref left;
     mulog_ref right;
+    struct mulog_idx *idx;
 };
 
-/* ===================
- * Query/mod functions
- * ===================
+// least payload, context and dictionary bytes of a column logger's segment; at least MULOG_CTX_BUFSZ
+#define MULOG_COL_BYTES 4096
+
+/* The segment being filled by a column logger (see mulog_col.h)
+ * The logger and its columns are allocated in one block when it is created, at a fixed
+ * capacity: a record whose payload, context or category doesn't fit in what's left of the
+ * segment starts a new one, so logging never allocates.
  */
+struct mulog_col {
+    mulog_lock lock;
+    FILE *fh;
+    uint32_t cap;               // records per segment
+    uint32_t n;                 // records in the segment so far
+    uint32_t levels;            // bitmap of the levels logged so far
+    int64_t *ts;                // absolute until the segment is written
+    uint8_t *lvl;
+    uint16_t *cat;
+    uint32_t *pay_off;          // cap + 1 offsets into pay
+    char *pay;
+    size_t pay_cap;
+    uint32_t *ctx_off;          // cap + 1 offsets into ctx
+    char *ctx;
+    size_t ctx_cap;
+    uint32_t ndict;
+    uint32_t *dict_off;         // cap + 1 offsets into dict
+    char *dict;
+    size_t dict_cap;
+    const char **fmt_key;       // categories in the dictionary, open-addressed by address
+    uint16_t *fmt_id;
+    uint32_t fmt_mask;
+};
 
-mulog_type mulog_get_type(mulog_ref l) {
-    if(!l) return mulog_t_dummy;
-    return l->type;
+struct mulog_t {
+    mulog_type type;
+    mulog_level min;            // threshold; read without a read section, so filtered messages cost a load
+    struct mulog_cfg *cfg;      // current configuration, NULL once the logger is being destroyed
+    mulog_shm_ring *ring;
+    size_t ringlen;
+    struct mulog_col *col;
+};
+
+/* ============
+ * Memory pools
+ * ============
+ * Messages are formatted into record buffers taken from a pool that is allocated once at
+ * initialization. Each thread keeps a small free list of records so the steady state needs
+ * neither malloc nor shared state; records too large for the pool use one of a few large
+ * buffers, and only fall back to the heap when those are exhausted.
+ * Logger objects come from the caller-supplied arena if one has been set.
+ * The shared lists are lock-free stacks, so a realtime thread refilling its list never waits
+ * for a lower-priority thread that was preempted while holding a lock.
+ */
+
+#if defined(__GNUC__)
+#define MULOG_TLS __thread
+#elif defined(_MSC_VER)
+#define MULOG_TLS __declspec(thread)
+#endif
+
+#define MULOG_POOL_DEF_RECSZ 512
+#define MULOG_POOL_DEF_RECCNT 64
+#define MULOG_POOL_DEF_PERTHR 8
+
+/* A free list shared between threads: a lock-free stack of equally sized nodes carved out of
+ * one region, each node starting with the index of the node below it
+ * The head holds the top node's index plus one (0 when empty) in its low half and a count of
+ * pushes in its high half, so a pop that read a top node which has since been popped and
+ * pushed back fails its compare-and-swap instead of installing a stale link (ABA).
+ */
+struct mulog_stack {
+    uint64_t head;
+    char *base;
+    size_t stride;
+};
+
+static void stack_push(struct mulog_stack *s, void *node) {
+    uint64_t idx = (uint64_t)((size_t)((char *)node - s->base) / s->stride) + 1;
+    uint64_t head = __atomic_load_n(&s->head, __ATOMIC_RELAXED);
+    do {
+        __atomic_store_n((uint32_t *)node, (uint32_t)head, __ATOMIC_RELAXED);
+    } while(!__atomic_compare_exchange_n(&s->head, &head, ((head >> 32) + 1) << 32 | idx, 1,
+                                         __ATOMIC_RELEASE, __ATOMIC_RELAXED));
 }
 
-FILE *mulog_get_file(mulog_ref l) {
-    if(!l) return NULL;
-    return l->fh;
+static void *stack_pop(struct mulog_stack *s) {
+    uint64_t head = __atomic_load_n(&s->head, __ATOMIC_ACQUIRE);
+    char *node;
+    uint32_t below;
+    do {
+        if(!(uint32_t)head) return NULL;
+        node = s->base + (size_t)((uint32_t)head - 1) * s->stride;
+        below = __atomic_load_n((uint32_t *)node, __ATOMIC_RELAXED);
+    } while(!__atomic_compare_exchange_n(&s->head, &head, (head & ~(uint64_t)UINT32_MAX) | below, 1,
+                                         __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+    return node;
 }
-mulog_status mulog_set_file(mulog_ref l, FILE *f) {
-    if(!l) return mulog_err_type;
-    switch(l->type) {
-    case mulog_t_file:
-        l->fh = f;
-        return mulog_ok;
-    default:
-        return mulog_err_type;
+
+enum mulog_blk_kind {
+    mulog_bk_rec,
+    mulog_bk_large,
+    mulog_bk_heap
+};
+
+struct mulog_blk {
+    uint32_t link;              // while on a shared list (see mulog_stack)
+    enum mulog_blk_kind kind;
+    size_t cap;
+    struct mulog_blk *next;     // while on a thread's list
+};
+
+struct mulog_pool {
+    mulog_lock lock;            // serializes setup
+    int init;
+    size_t rec_size;
+    size_t per_thread;
+    size_t large_size;
+    struct mulog_stack recs;    // shared free list of records
+    struct mulog_stack larges;  // shared free list of large buffers
+    unsigned long heap_allocs;
+#ifdef MULOG_UNIX
+    pthread_key_t key;
+#endif
+};
+static struct mulog_pool mulog_pool;
+
+struct mulog_tcache {
+    struct mulog_blk *head;
+    size_t count;
+    int reg;
+};
+static MULOG_TLS struct mulog_tcache mulog_tc;
+
+// returns count records from the cache at tc to the shared list
+static void tc_drain(struct mulog_tcache *tc, size_t count) {
+    struct mulog_blk *b;
+    while(count-- && (b = tc->head)) {
+        tc->head = b->next;
+        tc->count--;
+        stack_push(&mulog_pool.recs, b);
     }
 }
 
-int mulog_get_with_debug(mulog_ref l) {
-    if(!l) return -1;
-    switch(l->type) {
-    case mulog_t_file:
-    case mulog_t_con:
-        return l->flag & mulog_f_wdbg;
-    default:
-        return -1;
-    }
+#ifdef MULOG_UNIX
+static void tc_exit(void *tc) {
+    tc_drain(tc, (size_t)-1);
 }
-mulog_status mulog_set_with_debug(mulog_ref l, int with_debug) {
-    if(!l) return mulog_err_type;
-    switch(l->type) {
-    case mulog_t_file:
-    case mulog_t_con:
-        if(with_debug) l->flag |= mulog_f_wdbg;
-        else l->flag &= ~mulog_f_wdbg;
-        return mulog_ok;
-    default:
-        return mulog_err_type;
-    }
+#endif
+
+// makes the calling thread's cache be drained when the thread exits
+static void tc_register(void) {
+#ifdef MULOG_UNIX
+    if(!mulog_tc.reg) mulog_tc.reg = !pthread_setspecific(mulog_pool.key, &mulog_tc);
+#endif
 }
 
-int mulog_get_with_color(mulog_ref l) {
-    if(!l) return -1;
-    switch(l->type) {
-    case mulog_t_con:
-        return (l->flag & mulog_f_wclr) >> 1;
-    default:
-        return -1;
+static void tc_refill(void) {
+    struct mulog_blk *b;
+    size_t n = mulog_pool.per_thread;
+    while(n-- && (b = stack_pop(&mulog_pool.recs))) {
+        b->next = mulog_tc.head;
+        mulog_tc.head = b;
+        mulog_tc.count++;
     }
+    tc_register();
 }
-mulog_status mulog_set_with_color(mulog_ref l, int with_color) {
-    if(!l) return mulog_err_type;
-    switch(l->type) {
-    case mulog_t_con:
-        if(with_color) l->flag |= mulog_f_wclr;
-        else l->flag &= ~mulog_f_wclr;
-        return mulog_ok;
-    default:
-        return mulog_err_type;
+
+// carves count blocks of size bytes out of a single allocation onto the empty stack s
+static int pool_carve(struct mulog_stack *s, enum mulog_blk_kind kind, size_t size, size_t count) {
+    size_t stride = (sizeof(struct mulog_blk) + size + 15) & ~(size_t)15;
+    if(!count || !size) return 1;
+    if(stride < size || count >= UINT32_MAX || count > (size_t)-1 / stride) return 0;
+    if(!(s->base = malloc(stride * count))) return 0;
+    s->stride = stride;
+    while(count--) {
+        struct mulog_blk *b = (struct mulog_blk *)(s->base + stride * count);
+        b->cap = size;
+        b->kind = kind;
+        stack_push(s, b);
     }
+    return 1;
 }
 
-mulog_timefmt mulog_get_timefmt(mulog_ref l) {
-    if(!l) return mulog_tm_na;
-    return l->timefmt;
+#ifdef MULOG_UNIX
+static pthread_once_t mulog_pool_once = PTHREAD_ONCE_INIT;
+
+static void pool_lock_init(void) {
+    lock_init(&mulog_pool.lock);
 }
-mulog_status mulog_set_timefmt(mulog_ref l, mulog_timefmt timefmt) {
-    if(!l) return mulog_err_type;
-    switch(l->type) {
-    case mulog_t_file:
-    case mulog_t_con:
-        if(timefmt < mulog_tm_na && timefmt > -1) {
-            l->timefmt = timefmt;
-            return mulog_ok;
-        } else return mulog_err_inval;
-    default:
-        return mulog_err_type;
+#endif
+
+static mulog_status pool_setup(size_t rec_size, size_t rec_count, size_t per_thread, size_t large_size, size_t large_count) {
+    struct mulog_stack recs = {0, NULL, 0}, larges = {0, NULL, 0};
+    mulog_status st = mulog_ok;
+#ifdef MULOG_UNIX
+    pthread_once(&mulog_pool_once, pool_lock_init);
+#endif
+    pool_lock(&mulog_pool.lock);
+    if(mulog_pool.init) st = mulog_err_inval;
+    else if(!pool_carve(&recs, mulog_bk_rec, rec_size, rec_count)
+            || !pool_carve(&larges, mulog_bk_large, large_size, large_count)) {
+        free(recs.base);
+        st = mulog_err_nomem;
+    } else {
+        mulog_pool.rec_size = rec_size;
+        mulog_pool.per_thread = per_thread ? per_thread : 1;
+        mulog_pool.large_size = large_count ? large_size : 0;
+        mulog_pool.recs = recs;
+        mulog_pool.larges = larges;
+#ifdef MULOG_UNIX
+        pthread_key_create(&mulog_pool.key, tc_exit);
+#endif
+        __atomic_store_n(&mulog_pool.init, 1, __ATOMIC_RELEASE);
     }
+    pool_unlock(&mulog_pool.lock);
+    return st;
 }
 
-mulog_ref mulog_get_left(mulog_ref l) {
-    if(!l) return NULL;
-    return l->left;
+mulog_status mulog_pool_init(size_t rec_size, size_t rec_count, size_t per_thread, size_t large_size, size_t large_count) {
+    if(!rec_size || (large_count && large_size < rec_size)) return mulog_err_inval;
+    return pool_setup(rec_size, rec_count, per_thread, large_size, large_count);
 }
-mulog_ref mulog_get_right(mulog_ref l) {
-    if(!l) return NULL;
-    return l->right;
+
+unsigned long mulog_pool_heap_allocs(void) {
+    return __atomic_load_n(&mulog_pool.heap_allocs, __ATOMIC_RELAXED);
 }
-mulog_status mulog_set_left(mulog_ref l, mulog_ref left) {
-    if(!l) return mulog_err_type;
-    switch(l->type) {
-    case mulog_t_split:
-        l->left = left;
-        return mulog_ok;
-    default:
-        return mulog_err_type;
+
+char *mulog_rec_acquire(size_t len, size_t *cap) {
+    struct mulog_blk *b = NULL;
+
+    if(!__atomic_load_n(&mulog_pool.init, __ATOMIC_ACQUIRE))
+        pool_setup(MULOG_POOL_DEF_RECSZ, MULOG_POOL_DEF_RECCNT, MULOG_POOL_DEF_PERTHR, 0, 0);
+
+    if(len <= mulog_pool.rec_size) {
+        if(!mulog_tc.head) tc_refill();
+        if((b = mulog_tc.head)) {
+            mulog_tc.head = b->next;
+            mulog_tc.count--;
+        }
+    }
+    if(!b && len <= mulog_pool.large_size) b = stack_pop(&mulog_pool.larges);
+    if(!b) {
+        if(len < mulog_pool.rec_size) len = mulog_pool.rec_size;
+        if(!(b = malloc(sizeof(struct mulog_blk) + len))) return NULL;
+        b->cap = len;
+        b->kind = mulog_bk_heap;
+        __atomic_add_fetch(&mulog_pool.heap_allocs, 1, __ATOMIC_RELAXED);
     }
+    if(cap) *cap = b->cap;
+    return (char *)(b + 1);
 }
-mulog_status mulog_set_right(mulog_ref l, mulog_ref right) {
-    if(!l) return mulog_err_type;
-    switch(l->type) {
-    case mulog_t_split:
-        l->right = right;
-        return mulog_ok;
+
+void mulog_rec_release(char *rec) {
+    struct mulog_blk *b;
+    if(!rec) return;
+    b = (struct mulog_blk *)rec - 1;
+    switch(b->kind) {
+    case mulog_bk_rec:
+        // the releasing thread may never have acquired a record itself
+        tc_register();
+        b->next = mulog_tc.head;
+        mulog_tc.head = b;
+        if(++mulog_tc.count > 2 * mulog_pool.per_thread) tc_drain(&mulog_tc, mulog_pool.per_thread);
+        return;
+    case mulog_bk_large:
+        stack_push(&mulog_pool.larges, b);
+        return;
     default:
-        return mulog_err_type;
+        free(b);
+        return;
     }
 }
 
-/* ================
- * Destruction func
- * ================
- */
-
-void mulog_destroy(mulog_ref l) {
-    if(l) free(l);
-}
+// logger arena; each slot holds either a logger or one of its configuration snapshots
+#define MULOG_ARENA_OBJ (sizeof(struct mulog_t) > sizeof(struct mulog_cfg) ? sizeof(struct mulog_t) : sizeof(struct mulog_cfg))
+#define MULOG_ARENA_SLOT ((MULOG_ARENA_OBJ + 15) & ~(size_t)15)
 
-/* ==============
- * Creation funcs
- * ==============
- */
+struct mulog_arena {
+    char *base;
+    char *next;                 // first slot never handed out
+    char *end;
+    struct mulog_stack free;    // slots handed out and freed since
+};
+static struct mulog_arena mulog_arena;
 
-mulog_status mulog_create_file(mulog_ref *l, FILE *f, mulog_timefmt timefmt, int with_debug) {
-    if(timefmt < 0 || timefmt > mulog_tm_na) return mulog_err_inval;
-    mulog_ref m = malloc(sizeof(struct mulog_t));
-    m->type = mulog_t_file;
-    m->fh = f;
-    m->timefmt = timefmt;
-    m->left = NULL;
-    m->right = NULL;
-    m->flag = 0;
-    if(with_debug) m->flag |= mulog_f_wdbg;
-    *l = m;
-    return mulog_ok;
+size_t mulog_arena_size(size_t nloggers) {
+    // a logger and its configuration, plus one spare configuration for reconfiguring
+    return (2 * nloggers + 1) * MULOG_ARENA_SLOT + 15;
 }
 
-mulog_status mulog_create_con(mulog_ref *l, mulog_timefmt timefmt, int with_debug, int with_color) {
-#ifdef MULOG_WIN32
-    if(!mulog_hstdout) mulog_hstdout = GetStdHandle(STD_OUTPUT_HANDLE);
-    if(!mulog_hstderr) mulog_hstderr = GetStdHandle(STD_ERROR_HANDLE);
-#endif
-
-    if(timefmt < 0 || timefmt > mulog_tm_na) return mulog_err_inval;
-    mulog_ref m = malloc(sizeof(struct mulog_t));
-    m->type = mulog_t_con;
-    m->fh = NULL;
-    m->timefmt = timefmt;
-    m->left = NULL;
-    m->right = NULL;
-    m->flag = 0;
-    if(with_debug) m->flag |= mulog_f_wdbg;
-    if(with_color) m->flag |= mulog_f_wclr;
-    *l = m;
+mulog_status mulog_arena_init(void *mem, size_t size) {
+    char *base = (char *)(((size_t)mem + 15) & ~(size_t)15);
+    size_t slots;
+    if(!mem || size < (size_t)(base - (char *)mem) + MULOG_ARENA_SLOT) return mulog_err_inval;
+    slots = (size - (size_t)(base - (char *)mem)) / MULOG_ARENA_SLOT;
+    if(slots >= UINT32_MAX) slots = UINT32_MAX - 1;
+    mulog_arena.next = base;
+    mulog_arena.end = base + slots * MULOG_ARENA_SLOT;
+    mulog_arena.free.head = 0;
+    mulog_arena.free.base = base;
+    mulog_arena.free.stride = MULOG_ARENA_SLOT;
+    __atomic_store_n(&mulog_arena.base, base, __ATOMIC_RELEASE);
     return mulog_ok;
 }
 
-mulog_status mulog_create_split(mulog_ref *l, mulog_ref left, mulog_ref right) {
-    mulog_ref m = malloc(sizeof(struct mulog_t));
-    m->type = mulog_t_split;
-    m->fh = NULL;
-    m->timefmt = mulog_tm_na;
-    m->left = left;
-    m->right = right;
-    m->flag = 0;
-    *l = m;
-    return mulog_ok;
+static void *mulog_alloc(size_t size) {
+    char *m;
+    if(!__atomic_load_n(&mulog_arena.base, __ATOMIC_ACQUIRE)) return malloc(size);
+    if((m = stack_pop(&mulog_arena.free))) return m;
+    m = __atomic_load_n(&mulog_arena.next, __ATOMIC_RELAXED);
+    do {
+        if((size_t)(mulog_arena.end - m) < MULOG_ARENA_SLOT) return NULL;
+    } while(!__atomic_compare_exchange_n(&mulog_arena.next, &m, m + MULOG_ARENA_SLOT, 1,
+                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return m;
 }
 
-mulog_status mulog_create_dummy(mulog_ref *l) {
-    *l = NULL;
-    return mulog_ok;
+static void mulog_free(void *l) {
+    char *p = (char *)l;
+    if(mulog_arena.base && p >= mulog_arena.base && p < mulog_arena.end) stack_push(&mulog_arena.free, p);
+    else free(l);
 }
 
-/* =========
- * Msg funcs
- * =========
+/* =======================
+ * Configuration snapshots
+ * =======================
+ * Messages read a logger's configuration inside a read section, which takes no lock: each
+ * thread has a reader record whose sequence number is odd while the thread is inside one.
+ * A writer publishes a new snapshot and then waits for a grace period, i.e. until every
+ * thread that was inside a read section at the time has left it; only then is the old
+ * snapshot (and anything only it refers to) freed. Read sections nest, so a split logger
+ * keeps its sink loggers alive while it logs to them.
  */
 
-mulog_status mulog_append(mulog_ref l, const char * str, size_t len) {
+struct mulog_rdr {
+    uint64_t seq;               // odd while the thread is inside a read section
+    int used;                   // whether a thread owns the record
+    struct mulog_rdr *next;
+    char pad[64 - sizeof(uint64_t) - sizeof(int) - sizeof(void *)];
+};
+
+static struct mulog_rdr *mulog_rdrs = NULL;    // all records ever made; they are reused, never freed
+static mulog_lock mulog_cfg_lock;               // serializes writers
+static MULOG_TLS struct mulog_rdr *mulog_rd;
+static MULOG_TLS unsigned mulog_rd_nest;
 
+#ifdef MULOG_UNIX
+static pthread_once_t mulog_rd_once = PTHREAD_ONCE_INIT;
+static pthread_key_t mulog_rd_key;
+
+static void rdr_exit(void *r) {
+    mulog_rd = NULL;
+    __atomic_store_n(&((struct mulog_rdr *)r)->used, 0, __ATOMIC_RELEASE);
 }
 
-// formating helper func & constants
-const char* mulog_tc_long = "%c %Z";
-const char* mulog_tc_short = "%x %X %Z";
-const char* mulog_tc_fixed = "%Y-%m-%d %H:%M:%S";
-const char* mulog_s_err = "ERROR:";
-const char* mulog_s_warn = "WARNING:";
-const char* mulog_s_info = "INFO:";
-const char* mulog_s_dbg = "DEBUG:";
-void logstr(FILE *to, mulog_timefmt fmt, const char* msstr, const char* str, va_list va) {
-    static char tmstr[256];
-    static struct tm *tmtm;
-    static time_t ttm;
+static void rdr_key_init(void) {
+    pthread_key_create(&mulog_rd_key, rdr_exit);
+}
 
-    time(&ttm);
+static pthread_once_t mulog_cfg_once = PTHREAD_ONCE_INIT;
 
-    switch(fmt) {
-    case mulog_tm_long:
-        tmtm = localtime(&ttm);
-        strftime(tmstr, 256, mulog_tc_long, tmtm);
-        break;
-    case mulog_tm_short:
-        tmtm = localtime(&ttm);
-        strftime(tmstr, 256, mulog_tc_short, tmtm);
-        break;
-    case mulog_tm_fixed:
-        tmtm = gmtime(&ttm);
-        strftime(tmstr, 256, mulog_tc_fixed, tmtm);
-        break;
-    default: return;
-    }
+static void cfg_lock_init(void) {
+    lock_init(&mulog_cfg_lock);
+}
+#endif
 
-    fprintf(to, "[%s] %s ", tmstr, msstr);
-    vfprintf(to, str, va);
-    fputc('\n', to);
+static void cfg_lock(void) {
+#ifdef MULOG_UNIX
+    pthread_once(&mulog_cfg_once, cfg_lock_init);
+#endif
+    pool_lock(&mulog_cfg_lock);
 }
 
-void mulog_verr(mulog_ref l, const char* str, va_list va) {
-    if(!l) return;
-    va_list vasc;
-    switch(l->type) {
-    case mulog_t_file:
-        logstr(l->fh, l->timefmt, mulog_s_err, str, va);
-        return;
-    case mulog_t_con:
-        if(l->flag & mulog_f_wclr) UnixConClrSet(stderr, u_red, 1, u_none, 0);
-        if(l->flag & mulog_f_wclr) Win32ConClrSet(stderr, wfg_red, wbg_black);
-        logstr(stderr, l->timefmt, mulog_s_err, str, va);
-        if(l->flag & mulog_f_wclr) Win32ConClrReset(stderr);
-        if(l->flag & mulog_f_wclr) UnixConClrReset(stderr);
-        return;
-    case mulog_t_split:
-        va_copy(vasc, va);
-        mulog_verr(l->left, str, va);
-        mulog_verr(l->right, str, vasc);
-        va_end(vasc);
-        return;
-    default: return;
+// gives the calling thread a reader record, reusing one left by an exited thread if possible
+static struct mulog_rdr *rdr_register(void) {
+    struct mulog_rdr *r;
+    for(r = __atomic_load_n(&mulog_rdrs, __ATOMIC_ACQUIRE); r; r = r->next) {
+        int unused = 0;
+        if(!__atomic_load_n(&r->used, __ATOMIC_RELAXED)
+           && __atomic_compare_exchange_n(&r->used, &unused, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) break;
     }
-}
-void mulog_err(mulog_ref l, const char* str, ...) {
-    va_list va;
-    va_start(va, str);
-    mulog_verr(l, str, va);
-    va_end(va);
+    if(!r) {
+        if(!(r = calloc(1, sizeof(struct mulog_rdr)))) return NULL;
+        r->used = 1;
+        r->next = __atomic_load_n(&mulog_rdrs, __ATOMIC_RELAXED);
+        while(!__atomic_compare_exchange_n(&mulog_rdrs, &r->next, r, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+#ifdef MULOG_UNIX
+    pthread_once(&mulog_rd_once, rdr_key_init);
+    pthread_setspecific(mulog_rd_key, r);
+#endif
+    mulog_rd = r;
+    return r;
 }
 
-void mulog_vwarn(mulog_ref l, const char* str, va_list va) {
-    if(!l) return;
-    va_list vasc;
-    switch(l->type) {
-    case mulog_t_file:
-        logstr(l->fh, l->timefmt, mulog_s_warn, str, va);
-        return;
-    case mulog_t_con:
-        if(l->flag & mulog_f_wclr) UnixConClrSet(stderr, u_magenta, 1, u_none, 0);
-        if(l->flag & mulog_f_wclr) Win32ConClrSet(stderr, wfg_magenta, wbg_black);
-        logstr(stderr, l->timefmt, mulog_s_warn, str, va);
-        if(l->flag & mulog_f_wclr) Win32ConClrReset(stderr);
-        if(l->flag & mulog_f_wclr) UnixConClrReset(stderr);
-        return;
-    case mulog_t_split:
-        va_copy(vasc, va);
-        mulog_vwarn(l->left, str, va);
-        mulog_vwarn(l->right, str, vasc);
-        va_end(vasc);
-        return;
-    default: return;
-    }
+/* Enters a read section and returns l's configuration, to be used until cfg_leave()
+ * Returns NULL, without entering, if l is being destroyed or no reader record is available
+ */
+static struct mulog_cfg *cfg_enter(mulog_ref l) {
+    struct mulog_rdr *r = mulog_rd;
+    struct mulog_cfg *c;
+    if(!r && !(r = rdr_register())) return NULL;
+    // the sequence store must be visible before the configuration is read (see cfg_sync)
+    if(!mulog_rd_nest++) __atomic_store_n(&r->seq, __atomic_load_n(&r->seq, __ATOMIC_RELAXED) + 1, __ATOMIC_SEQ_CST);
+    c = __atomic_load_n(&l->cfg, __ATOMIC_SEQ_CST);
+    if(!c && !--mulog_rd_nest) __atomic_store_n(&r->seq, __atomic_load_n(&r->seq, __ATOMIC_RELAXED) + 1, __ATOMIC_RELEASE);
+    return c;
 }
-void mulog_warn(mulog_ref l, const char* str, ...) {
-    va_list va;
-    va_start(va, str);
-    mulog_vwarn(l, str, va);
-    va_end(va);
+
+static void cfg_leave(void) {
+    struct mulog_rdr *r = mulog_rd;
+    if(!--mulog_rd_nest) __atomic_store_n(&r->seq, __atomic_load_n(&r->seq, __ATOMIC_RELAXED) + 1, __ATOMIC_RELEASE);
 }
 
-void mulog_vinfo(mulog_ref l, const char* str, va_list va) {
-    if(!l) return;
-    va_list vasc;
-    switch(l->type) {
+// waits until every read section in progress when it was called has finished
+static void cfg_sync(void) {
+    struct mulog_rdr *r;
+    // the caller's seq_cst store of the new configuration orders it before the loads below
+    for(r = __atomic_load_n(&mulog_rdrs, __ATOMIC_ACQUIRE); r; r = r->next) {
+        uint64_t seq = __atomic_load_n(&r->seq, __ATOMIC_SEQ_CST);
+        int spins = 0;
+        if(!(seq & 1)) continue;
+        while(__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) == seq) {
+#ifdef MULOG_UNIX
+            // the reader may have been preempted; sleeping lets it run even where yielding doesn't
+            struct timespec ts = { 0, 20000 };
+            if(++spins < 16) sched_yield();
+            else nanosleep(&ts, NULL);
+#endif
+        }
+    }
+}
+
+static void idx_detach(struct mulog_cfg *c);
+
+/* Returns a private copy of l's configuration to be modified and published with cfg_commit()
+ * (or dropped with cfg_abort()); returns NULL if no memory is available
+ */
+static struct mulog_cfg *cfg_begin(mulog_ref l) {
+    struct mulog_cfg *c = mulog_alloc(sizeof(struct mulog_cfg));
+    if(!c) return NULL;
+    cfg_lock();
+    *c = *l->cfg;
+    return c;
+}
+
+static void cfg_abort(struct mulog_cfg *c) {
+    pool_unlock(&mulog_cfg_lock);
+    mulog_free(c);
+}
+
+/* Publishes c (NULL when destroying l), then frees the old configuration, and closes its
+ * index if c doesn't share it, after a grace period
+ */
+static void cfg_commit(mulog_ref l, struct mulog_cfg *c) {
+    struct mulog_cfg *old = l->cfg;
+    __atomic_store_n(&l->cfg, c, __ATOMIC_SEQ_CST);
+    pool_unlock(&mulog_cfg_lock);
+    cfg_sync();
+    if(old->idx && (!c || old->idx != c->idx)) idx_detach(old);
+    mulog_free(old);
+}
+
+/* ===============
+ * Thread contexts
+ * ===============
+ * Each thread keeps its context stack rendered as one prefix string ("key=value " per field),
+ * so pushing a field formats it once and logging only copies the prefix. Pushes that don't fit
+ * are counted in over, and leave the prefix alone until they are popped.
+ */
+#define MULOG_CTX_BUFSZ 512
+#define MULOG_CTX_DEPTH 16
+
+struct mulog_ctx {
+    size_t len;             // length of the rendered prefix
+    size_t depth;           // number of fields in the prefix
+    size_t over;            // number of pushes that didn't fit, on top of those
+    struct { unsigned short off, klen, vlen; } ent[MULOG_CTX_DEPTH];
+    char buf[MULOG_CTX_BUFSZ];
+};
+
+static MULOG_TLS struct mulog_ctx mulog_ctx;
+
+mulog_status mulog_ctx_push(const char *key, const char *value) {
+    struct mulog_ctx *c = &mulog_ctx;
+    size_t klen = key ? strlen(key) : 0;
+    size_t vlen = value ? strlen(value) : 0;
+    // "key=value " or "value "
+    size_t need = (klen ? klen + 1 : 0) + vlen + 1;
+    char *p;
+
+    if(c->over || c->depth == MULOG_CTX_DEPTH || c->len + need > MULOG_CTX_BUFSZ) {
+        c->over++;
+        return mulog_err_nomem;
+    }
+    c->ent[c->depth].off = (unsigned short)c->len;
+    c->ent[c->depth].klen = (unsigned short)klen;
+    c->ent[c->depth].vlen = (unsigned short)vlen;
+    c->depth++;
+    p = c->buf + c->len;
+    if(klen) {
+        memcpy(p, key, klen);
+        p[klen] = '=';
+        p += klen + 1;
+    }
+    memcpy(p, value, vlen);
+    p[vlen] = ' ';
+    c->len += need;
+    return mulog_ok;
+}
+
+void mulog_ctx_pop(void) {
+    struct mulog_ctx *c = &mulog_ctx;
+    if(c->over) c->over--;
+    else if(c->depth) c->len = c->ent[--c->depth].off;
+}
+
+const char *mulog_ctx_prefix(size_t *len) {
+    if(len) *len = mulog_ctx.len;
+    return mulog_ctx.buf;
+}
+
+size_t mulog_ctx_count(void) {
+    return mulog_ctx.depth;
+}
+
+mulog_status mulog_ctx_field(size_t i, const char **key, size_t *klen, const char **value, size_t *vlen) {
+    struct mulog_ctx *c = &mulog_ctx;
+    const char *p;
+    if(i >= c->depth) return mulog_err_inval;
+    p = c->buf + c->ent[i].off;
+    if(key) *key = p;
+    if(klen) *klen = c->ent[i].klen;
+    if(value) *value = c->ent[i].klen ? p + c->ent[i].klen + 1 : p;
+    if(vlen) *vlen = c->ent[i].vlen;
+    return mulog_ok;
+}
+
+/* ==========
+ * Backtraces
+ * ==========
+ * Error messages can carry a backtrace in the context field "bt". Only the raw return
+ * addresses are captured on the logging thread; the trace gets a number, and a background
+ * thread symbolizes it (with dladdr, through a cache keyed by address) and writes it out.
+ * Traces that can't be queued, or all of them if there is no output, carry the return addresses
+ * themselves, as offsets into the modules mapped when tracing started so that they can be
+ * symbolized offline. The field is cut to whole frames that fit in the thread's context.
+ */
+#if MULOG_TRACE
+
+#define MULOG_TRACE_MAXDEPTH 32
+#define MULOG_TRACE_SKIP 8          // most frames of mulog's own searched for the caller's
+#define MULOG_TRACE_QLEN 64
+#define MULOG_TRACE_CACHE 1024      // a power of two
+#define MULOG_TRACE_MODS 64
+
+struct mulog_trace_ent {
+    unsigned long long id;
+    int n;
+    void *addr[MULOG_TRACE_MAXDEPTH];
+};
+
+struct mulog_trace {
+    pthread_mutex_t mtx;
+    pthread_cond_t cv;
+    int depth;                  // frames to capture, 0 while tracing is off
+    int running;                // whether the symbolizer thread has been started
+    int stop;
+    FILE *out;
+    pthread_t thr;
+    unsigned long long next_id;
+    size_t head, tail;          // queue positions; head - tail traces are pending
+    struct mulog_trace_ent q[MULOG_TRACE_QLEN];
+};
+static struct mulog_trace mulog_trace = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0, 0, NULL };
+
+// symbol cache, only used by the symbolizer thread
+struct mulog_sym {
+    void *addr;
+    const char *file;
+    const char *name;           // NULL if the address isn't covered by an exported symbol
+    size_t off;                 // from the symbol, or from the module base if there is none
+};
+static struct mulog_sym mulog_syms[MULOG_TRACE_CACHE];
+
+// executable segments of the modules mapped when tracing started, for the raw form of traces
+struct mulog_mod {
+    uintptr_t lo, hi;
+    uintptr_t base;             // load address, which offsets are relative to
+    const char *name;           // file name without its directory
+};
+static struct mulog_mod mulog_mods[MULOG_TRACE_MODS];
+static int mulog_nmods;
+
+static int trace_mod(struct dl_phdr_info *info, size_t size, void *arg) {
+    const char *name = info->dlpi_name && *info->dlpi_name ? info->dlpi_name : program_invocation_name;
+    const char *slash = strrchr(name, '/');
+    int i;
+    (void)size;
+    (void)arg;
+    for(i = 0; i < info->dlpi_phnum && mulog_nmods < MULOG_TRACE_MODS; i++) {
+        const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+        if(ph->p_type != PT_LOAD || !(ph->p_flags & PF_X)) continue;
+        mulog_mods[mulog_nmods].lo = info->dlpi_addr + ph->p_vaddr;
+        mulog_mods[mulog_nmods].hi = info->dlpi_addr + ph->p_vaddr + ph->p_memsz;
+        mulog_mods[mulog_nmods].base = info->dlpi_addr;
+        mulog_mods[mulog_nmods].name = slash ? slash + 1 : name;
+        mulog_nmods++;
+    }
+    return 0;
+}
+
+/* Writes addr to buf (of room bytes) as "module+0xoffset", or as the bare address if it isn't in
+ * a module mapped when tracing started; returns the length, or -1 if it doesn't fit
+ */
+static int trace_raw(char *buf, size_t room, void *addr) {
+    uintptr_t a = (uintptr_t)addr;
+    int i, w = -1;
+    for(i = 0; i < mulog_nmods; i++) {
+        if(a >= mulog_mods[i].lo && a < mulog_mods[i].hi) break;
+    }
+    if(i < mulog_nmods) w = snprintf(buf, room, "%s+0x%zx", mulog_mods[i].name, (size_t)(a - mulog_mods[i].base));
+    else w = snprintf(buf, room, "%p", addr);
+    return w < 0 || (size_t)w >= room ? -1 : w;
+}
+
+static const struct mulog_sym *trace_sym(void *addr) {
+    size_t h = (size_t)(((uint64_t)(uintptr_t)addr * 0x9E3779B97F4A7C15ull) >> 32) & (MULOG_TRACE_CACHE - 1);
+    struct mulog_sym *e = NULL;
+    Dl_info info;
+    int i;
+
+    for(i = 0; i < 8; i++) {
+        struct mulog_sym *c = &mulog_syms[(h + i) & (MULOG_TRACE_CACHE - 1)];
+        if(c->addr == addr) return c;
+        if(!c->addr) {
+            e = c;
+            break;
+        }
+    }
+    // not cached: take a free slot in the probe window, or evict the first one
+    if(!e) e = &mulog_syms[h];
+    e->addr = addr;
+    e->file = "??";
+    e->name = NULL;
+    e->off = (size_t)addr;
+    if(dladdr(addr, &info)) {
+        if(info.dli_fname) e->file = info.dli_fname;
+        e->name = info.dli_sname;
+        e->off = (size_t)((char *)addr - (char *)(info.dli_sname && info.dli_saddr ? info.dli_saddr : info.dli_fbase));
+    }
+    return e;
+}
+
+static void trace_write(const struct mulog_trace_ent *t) {
+    int i;
+    for(i = 0; i < t->n; i++) {
+        const struct mulog_sym *s = trace_sym(t->addr[i]);
+        fprintf(mulog_trace.out, "[bt=%llu] #%d %s(%s+0x%zx) [%p]\n", t->id, i, s->file, s->name ? s->name : "", s->off, t->addr[i]);
+    }
+    fflush(mulog_trace.out);
+}
+
+static void *trace_thread(void *arg) {
+    struct mulog_trace_ent t;
+    (void)arg;
+    pthread_mutex_lock(&mulog_trace.mtx);
+    for(;;) {
+        while(mulog_trace.head == mulog_trace.tail && !mulog_trace.stop) pthread_cond_wait(&mulog_trace.cv, &mulog_trace.mtx);
+        if(mulog_trace.head == mulog_trace.tail) break;
+        t = mulog_trace.q[mulog_trace.tail++ % MULOG_TRACE_QLEN];
+        pthread_mutex_unlock(&mulog_trace.mtx);
+        trace_write(&t);
+        pthread_mutex_lock(&mulog_trace.mtx);
+    }
+    pthread_mutex_unlock(&mulog_trace.mtx);
+    return NULL;
+}
+
+/* Captures a backtrace, from the frame that from returns to, and pushes it onto the thread's
+ * context; without from, or if it isn't found, the backtrace starts past trace_push and vlog
+ * Returns 1 if the context field must be popped after the message
+ */
+__attribute__((noinline)) static int trace_push(const void *from) {
+    void *addr[MULOG_TRACE_MAXDEPTH + MULOG_TRACE_SKIP];
+    char field[MULOG_CTX_BUFSZ];
+    int depth = __atomic_load_n(&mulog_trace.depth, __ATOMIC_ACQUIRE);
+    int n, i, skip, queued = 0;
+    size_t len = 0, room;
+
+    if(!depth) return 0;
+    // the field must fit in the context as "bt=field "; room counts its terminating NUL
+    if(mulog_ctx.over || mulog_ctx.depth == MULOG_CTX_DEPTH || mulog_ctx.len + 4 > MULOG_CTX_BUFSZ) return 0;
+    room = MULOG_CTX_BUFSZ - mulog_ctx.len - 3;
+    n = backtrace(addr, depth + MULOG_TRACE_SKIP);
+    for(skip = 1; skip < n && skip < MULOG_TRACE_SKIP && addr[skip] != from; skip++);
+    if(skip == n || skip == MULOG_TRACE_SKIP) skip = 2;
+    n = n - skip < depth ? n - skip : depth;
+    if(n <= 0) return 0;
+
+    if(mulog_trace.out && room > 20) {
+        pthread_mutex_lock(&mulog_trace.mtx);
+        if(mulog_trace.running && mulog_trace.head - mulog_trace.tail < MULOG_TRACE_QLEN) {
+            struct mulog_trace_ent *t = &mulog_trace.q[mulog_trace.head++ % MULOG_TRACE_QLEN];
+            t->id = ++mulog_trace.next_id;
+            t->n = n;
+            memcpy(t->addr, addr + skip, n * sizeof(void *));
+            snprintf(field, room, "%llu", t->id);
+            pthread_cond_signal(&mulog_trace.cv);
+            queued = 1;
+        }
+        pthread_mutex_unlock(&mulog_trace.mtx);
+    }
+    if(!queued) {
+        // return addresses separated by commas, dropping the outermost frames that don't fit
+        for(i = 0; i < n; i++) {
+            size_t sep = i ? 1 : 0;
+            int w = len + sep < room ? trace_raw(field + len + sep, room - len - sep, addr[skip + i]) : -1;
+            if(w < 0) break;
+            if(sep) field[len] = ',';
+            len += sep + (size_t)w;
+        }
+        if(!len) return 0;
+        field[len] = '\0';
+    }
+    mulog_ctx_push("bt", field);
+    return 1;
+}
+
+mulog_status mulog_trace_start(int depth, FILE *out) {
+    void *warm[1];
+    mulog_status st = mulog_ok;
+
+    if(depth < 1 || depth > MULOG_TRACE_MAXDEPTH) return mulog_err_inval;
+    // the first backtrace() call loads the unwinder, which allocates
+    backtrace(warm, 1);
+    pthread_mutex_lock(&mulog_trace.mtx);
+    if(mulog_trace.depth || mulog_trace.running) st = mulog_err_inval;
+    else {
+        mulog_trace.out = out;
+        mulog_trace.stop = 0;
+        mulog_nmods = 0;
+        dl_iterate_phdr(trace_mod, NULL);
+        if(out) {
+            if(pthread_create(&mulog_trace.thr, NULL, trace_thread, NULL)) st = mulog_err_nomem;
+            else mulog_trace.running = 1;
+        }
+        if(st == mulog_ok) __atomic_store_n(&mulog_trace.depth, depth, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&mulog_trace.mtx);
+    return st;
+}
+
+void mulog_trace_stop(void) {
+    int running;
+    pthread_mutex_lock(&mulog_trace.mtx);
+    __atomic_store_n(&mulog_trace.depth, 0, __ATOMIC_RELEASE);
+    running = mulog_trace.running;
+    mulog_trace.stop = 1;
+    pthread_cond_signal(&mulog_trace.cv);
+    pthread_mutex_unlock(&mulog_trace.mtx);
+    if(!running) return;
+    pthread_join(mulog_trace.thr, NULL);
+    pthread_mutex_lock(&mulog_trace.mtx);
+    mulog_trace.running = 0;
+    pthread_mutex_unlock(&mulog_trace.mtx);
+}
+
+#else
+
+static int trace_push(const void *from) {
+    (void)from;
+    return 0;
+}
+
+mulog_status mulog_trace_start(int depth, FILE *out) {
+    (void)depth;
+    (void)out;
+    return mulog_err_type;
+}
+
+void mulog_trace_stop(void) {
+}
+
+#endif // MULOG_TRACE
+
+/* ===================
+ * Query/mod functions
+ * ===================
+ */
+
+static void idx_close(const struct mulog_cfg *c);
+static void col_close(struct mulog_col *b);
+
+mulog_type mulog_get_type(mulog_ref l) {
+    if(!l) return mulog_t_dummy;
+    return l->type;
+}
+
+FILE *mulog_get_file(mulog_ref l) {
+    struct mulog_cfg *c;
+    FILE *f;
+    if(!l || !(c = cfg_enter(l))) return NULL;
+    f = c->fh;
+    cfg_leave();
+    return f;
+}
+mulog_status mulog_set_file(mulog_ref l, FILE *f) {
+    struct mulog_cfg *c;
+    if(!l) return mulog_err_type;
+    switch(l->type) {
+    case mulog_t_file:
+        if(!(c = cfg_begin(l))) return mulog_err_nomem;
+        c->fh = f;
+        c->idx = NULL;
+        cfg_commit(l, c);
+        return mulog_ok;
+    default:
+        return mulog_err_type;
+    }
+}
+
+FILE *mulog_get_index(mulog_ref l) {
+    struct mulog_cfg *c;
+    FILE *f;
+    if(!l || !(c = cfg_enter(l))) return NULL;
+    f = c->idx ? c->idx->fh : NULL;
+    cfg_leave();
+    return f;
+}
+mulog_status mulog_set_index(mulog_ref l, FILE *idx, size_t every_kb) {
+    mulog_idx_header hdr = { { 'M', 'L', 'I', 'X' }, MULOG_IDX_VERSION, 0 };
+    struct mulog_idx *x = NULL;
+    struct mulog_cfg *c;
+    if(!l) return mulog_err_type;
+    switch(l->type) {
+    case mulog_t_file:
+        if(idx) {
+            if(!every_kb) return mulog_err_inval;
+            if(!(x = malloc(sizeof(struct mulog_idx)))) return mulog_err_nomem;
+            x->fh = idx;
+            x->every = every_kb * 1024;
+            x->bytes = 0;
+            memset(&x->ent, 0, sizeof(x->ent));
+        }
+        if(!(c = cfg_begin(l))) {
+            free(x);
+            return mulog_err_nomem;
+        }
+        if(x && (!c->fh || ftell(c->fh) < 0)) {
+            cfg_abort(c);
+            free(x);
+            return mulog_err_inval;
+        }
+        if(x && ftell(idx) <= 0) {
+            hdr.block_size = x->every;
+            fwrite(&hdr, sizeof(hdr), 1, idx);
+        }
+        c->idx = x;
+        cfg_commit(l, c);
+        return mulog_ok;
+    default:
+        return mulog_err_type;
+    }
+}
+
+int mulog_get_level(mulog_ref l) {
+    if(!l) return -1;
+    return __atomic_load_n(&l->min, __ATOMIC_RELAXED);
+}
+mulog_status mulog_set_level(mulog_ref l, mulog_level lvl) {
+    if(!l) return mulog_err_type;
+    if((unsigned)lvl > mulog_l_catastrophic) return mulog_err_inval;
+    __atomic_store_n(&l->min, lvl, __ATOMIC_RELAXED);
+    return mulog_ok;
+}
+
+int mulog_get_with_debug(mulog_ref l) {
+    if(!l) return -1;
+    switch(l->type) {
     case mulog_t_file:
-        logstr(l->fh, l->timefmt, mulog_s_info, str, va);
-        return;
     case mulog_t_con:
-        if(l->flag & mulog_f_wclr) UnixConClrSet(stdout, u_cyan, 1, u_none, 0);
-        if(l->flag & mulog_f_wclr) Win32ConClrSet(stdout, wfg_cyan, wbg_black);
-        logstr(stdout, l->timefmt, mulog_s_info, str, va);
-        if(l->flag & mulog_f_wclr) Win32ConClrReset(stdout);
-        if(l->flag & mulog_f_wclr) UnixConClrReset(stdout);
-        return;
+    case mulog_t_shm:
+    case mulog_t_col:
+        return __atomic_load_n(&l->min, __ATOMIC_RELAXED) <= mulog_l_debug;
+    default:
+        return -1;
+    }
+}
+mulog_status mulog_set_with_debug(mulog_ref l, int with_debug) {
+    if(!l) return mulog_err_type;
+    switch(l->type) {
+    case mulog_t_file:
+    case mulog_t_con:
+    case mulog_t_shm:
+    case mulog_t_col:
+        return mulog_set_level(l, with_debug ? mulog_l_vdebug : mulog_l_info);
+    default:
+        return mulog_err_type;
+    }
+}
+
+int mulog_get_with_color(mulog_ref l) {
+    struct mulog_cfg *c;
+    int r;
+    if(!l) return -1;
+    switch(l->type) {
+    case mulog_t_con:
+        if(!(c = cfg_enter(l))) return -1;
+        r = (c->flag & mulog_f_wclr) >> 1;
+        cfg_leave();
+        return r;
+    default:
+        return -1;
+    }
+}
+mulog_status mulog_set_with_color(mulog_ref l, int with_color) {
+    struct mulog_cfg *c;
+    if(!l) return mulog_err_type;
+    switch(l->type) {
+    case mulog_t_con:
+        if(!(c = cfg_begin(l))) return mulog_err_nomem;
+        if(with_color) c->flag |= mulog_f_wclr;
+        else c->flag &= ~mulog_f_wclr;
+        cfg_commit(l, c);
+        return mulog_ok;
+    default:
+        return mulog_err_type;
+    }
+}
+
+mulog_timefmt mulog_get_timefmt(mulog_ref l) {
+    struct mulog_cfg *c;
+    mulog_timefmt r;
+    if(!l || !(c = cfg_enter(l))) return mulog_tm_na;
+    r = c->timefmt;
+    cfg_leave();
+    return r;
+}
+mulog_status mulog_set_timefmt(mulog_ref l, mulog_timefmt timefmt) {
+    struct mulog_cfg *c;
+    if(!l) return mulog_err_type;
+    switch(l->type) {
+    case mulog_t_file:
+    case mulog_t_con:
+    case mulog_t_shm:
+        if(timefmt < mulog_tm_na && timefmt > -1) {
+            if(!(c = cfg_begin(l))) return mulog_err_nomem;
+            c->timefmt = timefmt;
+            cfg_commit(l, c);
+            return mulog_ok;
+        } else return mulog_err_inval;
+    default:
+        return mulog_err_type;
+    }
+}
+
+mulog_ref mulog_get_left(mulog_ref l) {
+    struct mulog_cfg *c;
+    mulog_ref r;
+    if(!l || !(c = cfg_enter(l))) return NULL;
+    r = c->left;
+    cfg_leave();
+    return r;
+}
+mulog_ref mulog_get_right(mulog_ref l) {
+    struct mulog_cfg *c;
+    mulog_ref r;
+    if(!l || !(c = cfg_enter(l))) return NULL;
+    r = c->right;
+    cfg_leave();
+    return r;
+}
+mulog_status mulog_set_left(mulog_ref l, mulog_ref left) {
+    struct mulog_cfg *c;
+    if(!l) return mulog_err_type;
+    switch(l->type) {
     case mulog_t_split:
+        if(!(c = cfg_begin(l))) return mulog_err_nomem;
+        c->left = left;
+        cfg_commit(l, c);
+        return mulog_ok;
+    default:
+        return mulog_err_type;
+    }
+}
+mulog_status mulog_set_right(mulog_ref l, mulog_ref right) {
+    struct mulog_cfg *c;
+    if(!l) return mulog_err_type;
+    switch(l->type) {
+    case mulog_t_split:
+        if(!(c = cfg_begin(l))) return mulog_err_nomem;
+        c->right = right;
+        cfg_commit(l, c);
+        return mulog_ok;
+    default:
+        return mulog_err_type;
+    }
+}
+
+/* ================
+ * Destruction func
+ * ================
+ */
+
+void mulog_destroy(mulog_ref l) {
+    if(!l) return;
+    cfg_lock();
+    cfg_commit(l, NULL);
+#ifdef MULOG_UNIX
+    if(l->ring) munmap(l->ring, l->ringlen);
+#endif
+    if(l->col) col_close(l->col);
+    mulog_free(l);
+}
+
+/* ==============
+ * Creation funcs
+ * ==============
+ */
+
+#ifdef MULOG_UNIX
+static void con_init(void);
+#endif
+
+// allocates a logger of the given type with an empty configuration
+static mulog_ref mulog_new(mulog_type type) {
+    mulog_ref m = mulog_alloc(sizeof(struct mulog_t));
+    struct mulog_cfg *c = mulog_alloc(sizeof(struct mulog_cfg));
+    if(!m || !c) {
+        if(m) mulog_free(m);
+        if(c) mulog_free(c);
+        return NULL;
+    }
+    c->timefmt = mulog_tm_na;
+    c->flag = 0;
+    c->fh = NULL;
+    c->left = NULL;
+    c->right = NULL;
+    c->idx = NULL;
+    m->type = type;
+    m->min = mulog_l_vdebug;
+    m->cfg = c;
+    m->ring = NULL;
+    m->ringlen = 0;
+    m->col = NULL;
+    return m;
+}
+
+mulog_status mulog_create_file(mulog_ref *l, FILE *f, mulog_timefmt timefmt, int with_debug) {
+    if(timefmt < 0 || timefmt > mulog_tm_na) return mulog_err_inval;
+    mulog_ref m = mulog_new(mulog_t_file);
+    if(!m) return mulog_err_nomem;
+    m->cfg->fh = f;
+    m->cfg->timefmt = timefmt;
+    if(!with_debug) m->min = mulog_l_info;
+    *l = m;
+    return mulog_ok;
+}
+
+mulog_status mulog_create_con(mulog_ref *l, mulog_timefmt timefmt, int with_debug, int with_color) {
+#ifdef MULOG_WIN32
+    if(!mulog_hstdout) mulog_hstdout = GetStdHandle(STD_OUTPUT_HANDLE);
+    if(!mulog_hstderr) mulog_hstderr = GetStdHandle(STD_ERROR_HANDLE);
+#endif
+#ifdef MULOG_UNIX
+    con_init();
+#endif
+
+    if(timefmt < 0 || timefmt > mulog_tm_na) return mulog_err_inval;
+    mulog_ref m = mulog_new(mulog_t_con);
+    if(!m) return mulog_err_nomem;
+    m->cfg->timefmt = timefmt;
+    if(!with_debug) m->min = mulog_l_info;
+    if(with_color) m->cfg->flag |= mulog_f_wclr;
+    *l = m;
+    return mulog_ok;
+}
+
+mulog_status mulog_create_split(mulog_ref *l, mulog_ref left, mulog_ref right) {
+    mulog_ref m = mulog_new(mulog_t_split);
+    if(!m) return mulog_err_nomem;
+    m->cfg->left = left;
+    m->cfg->right = right;
+    *l = m;
+    return mulog_ok;
+}
+
+#ifdef MULOG_UNIX
+// cached so the logging path doesn't need a getpid() call; refreshed in forked children
+static pid_t mulog_shm_pid = 0;
+
+static void shm_atfork(void) {
+    mulog_shm_pid = getpid();
+}
+#endif
+
+mulog_status mulog_create_shm(mulog_ref *l, const char *name, mulog_timefmt timefmt, int with_debug) {
+#ifdef MULOG_UNIX
+    static int atfork = 0;
+    mulog_shm_ring *ring;
+    struct stat st;
+    int fd;
+
+    if(timefmt < 0 || timefmt >= mulog_tm_na || !name) return mulog_err_inval;
+    if((fd = shm_open(name, O_RDWR, 0)) < 0) return mulog_err_inval;
+    if(fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(mulog_shm_ring)) {
+        close(fd);
+        return mulog_err_inval;
+    }
+    ring = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(ring == MAP_FAILED) return mulog_err_nomem;
+    if(ring->magic != MULOG_SHM_MAGIC || ring->version != MULOG_SHM_VERSION
+       || (size_t)st.st_size < mulog_shm_size(ring->slot_count, ring->slot_size)) {
+        munmap(ring, (size_t)st.st_size);
+        return mulog_err_inval;
+    }
+
+    mulog_ref m = mulog_new(mulog_t_shm);
+    if(!m) {
+        munmap(ring, (size_t)st.st_size);
+        return mulog_err_nomem;
+    }
+    m->cfg->timefmt = timefmt;
+    if(!with_debug) m->min = mulog_l_info;
+    m->ring = ring;
+    m->ringlen = (size_t)st.st_size;
+
+    if(!__atomic_exchange_n(&atfork, 1, __ATOMIC_ACQ_REL)) {
+        shm_atfork();
+        pthread_atfork(NULL, NULL, shm_atfork);
+    }
+    *l = m;
+    return mulog_ok;
+#else
+    return mulog_err_type;
+#endif
+}
+
+mulog_status mulog_create_col(mulog_ref *l, FILE *f, size_t seg_records, int with_debug) {
+    struct mulog_col *b;
+    size_t n = seg_records, head = (sizeof(struct mulog_col) + 7) & ~(size_t)7;
+    size_t pay = n * 64 > MULOG_COL_BYTES ? n * 64 : MULOG_COL_BYTES;
+    size_t ctx = n * 16 > MULOG_COL_BYTES ? n * 16 : MULOG_COL_BYTES;
+    uint32_t slots = 16;
+    char *p;
+
+    if(!f || !seg_records || seg_records > MULOG_COL_MAX) return mulog_err_inval;
+    // at most one dictionary entry per record, so the table stays at most half full
+    while(slots < 2 * seg_records) slots *= 2;
+    // the columns follow the logger, widest elements first so that each is aligned
+    b = calloc(1, head + n * sizeof(int64_t) + slots * sizeof(const char *) + 3 * (n + 1) * sizeof(uint32_t)
+                  + (n + slots) * sizeof(uint16_t) + n + pay + ctx + MULOG_COL_BYTES);
+    if(!b) return mulog_err_nomem;
+    p = (char *)b + head;
+    b->ts = (int64_t *)p;
+    p += n * sizeof(int64_t);
+    b->fmt_key = (const char **)p;
+    p += slots * sizeof(const char *);
+    b->pay_off = (uint32_t *)p;
+    p += (n + 1) * sizeof(uint32_t);
+    b->ctx_off = (uint32_t *)p;
+    p += (n + 1) * sizeof(uint32_t);
+    b->dict_off = (uint32_t *)p;
+    p += (n + 1) * sizeof(uint32_t);
+    b->cat = (uint16_t *)p;
+    p += n * sizeof(uint16_t);
+    b->fmt_id = (uint16_t *)p;
+    p += slots * sizeof(uint16_t);
+    b->lvl = (uint8_t *)p;
+    b->pay = p + n;
+    b->ctx = b->pay + pay;
+    b->dict = b->ctx + ctx;
+    lock_init(&b->lock);
+    b->fh = f;
+    b->cap = (uint32_t)seg_records;
+    b->pay_cap = pay;
+    b->ctx_cap = ctx;
+    b->dict_cap = MULOG_COL_BYTES;
+    b->fmt_mask = slots - 1;
+
+    mulog_ref m = mulog_new(mulog_t_col);
+    if(!m) {
+        col_close(b);
+        return mulog_err_nomem;
+    }
+    if(!with_debug) m->min = mulog_l_info;
+    m->col = b;
+    *l = m;
+    return mulog_ok;
+}
+
+mulog_status mulog_create_dummy(mulog_ref *l) {
+    *l = NULL;
+    return mulog_ok;
+}
+
+/* ===============
+ * UTF-8 transcoding
+ * ===============
+ * UTF-16 and UTF-32 messages are converted while their record is formatted. Runs of ASCII (and,
+ * for UTF-16, runs of two-byte characters) are handled eight code units at a time with SSE2
+ * where it is available, and everything else one character at a time.
+ */
+
+// writes code point cp at dst; returns the number of bytes written, or 0 if they don't fit in room
+static size_t put_utf8(uint32_t cp, char *dst, size_t room) {
+    if(cp < 0x80) {
+        if(room < 1) return 0;
+        dst[0] = (char)cp;
+        return 1;
+    }
+    if(cp < 0x800) {
+        if(room < 2) return 0;
+        dst[0] = (char)(0xC0 | (cp >> 6));
+        dst[1] = (char)(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if(cp < 0x10000) {
+        if(room < 3) return 0;
+        dst[0] = (char)(0xE0 | (cp >> 12));
+        dst[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        dst[2] = (char)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    if(room < 4) return 0;
+    dst[0] = (char)(0xF0 | (cp >> 18));
+    dst[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+    dst[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    dst[3] = (char)(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+static size_t len_utf8(uint32_t cp) {
+    return cp < 0x80 ? 1 : cp < 0x800 ? 2 : cp < 0x10000 ? 3 : 4;
+}
+
+// decodes the character at src[*i], advancing *i; unpaired surrogates become U+FFFD
+static uint32_t get_utf16(const uint16_t *src, size_t len, size_t *i) {
+    uint32_t c = src[(*i)++];
+    if(c >= 0xD800 && c < 0xE000) {
+        if(c < 0xDC00 && *i < len && src[*i] >= 0xDC00 && src[*i] < 0xE000) {
+            c = 0x10000 + ((c - 0xD800) << 10) + (uint32_t)(src[(*i)++] - 0xDC00);
+        } else c = 0xFFFD;
+    }
+    return c;
+}
+
+static uint32_t get_utf32(uint32_t c) {
+    return c > 0x10FFFF || (c >= 0xD800 && c < 0xE000) ? 0xFFFD : c;
+}
+
+#if MULOG_UTF8_SSE2
+static int ctz(unsigned v) {
+#ifdef _MSC_VER
+    unsigned long idx;
+    _BitScanForward(&idx, v);
+    return (int)idx;
+#else
+    return __builtin_ctz(v);
+#endif
+}
+#endif
+
+/* Converts the len code units at src to at most cap bytes of UTF-8 at dst, stopping before the
+ * first character that doesn't fit; returns the bytes written and stores the units read in *used
+ */
+static size_t utf16_conv(const uint16_t *src, size_t len, char *dst, size_t cap, size_t *used) {
+    size_t i = 0, o = 0;
+
+    while(i < len) {
+        size_t n, at;
+#if MULOG_UTF8_SSE2
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i not_ascii = _mm_set1_epi16((short)0xFF80);
+        const __m128i not_two = _mm_set1_epi16((short)0xF800);
+        // stores are at most 16 bytes wide, so keep that much room
+        while(i + 8 <= len && o + 16 <= cap) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+            int ascii = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, not_ascii), zero));
+            int two;
+            if(ascii == 0xFFFF) {
+                _mm_storel_epi64((__m128i *)(dst + o), _mm_packus_epi16(v, v));
+                i += 8;
+                o += 8;
+                continue;
+            }
+            two = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, not_two), zero));
+            if(two == 0xFFFF && !ascii) {
+                // all in U+0080..U+07FF: 110xxxxx 10xxxxxx, lead byte first in each 16-bit lane
+                __m128i lead = _mm_or_si128(_mm_srli_epi16(v, 6), _mm_set1_epi16(0xC0));
+                __m128i cont = _mm_or_si128(_mm_and_si128(v, _mm_set1_epi16(0x3F)), _mm_set1_epi16(0x80));
+                _mm_storeu_si128((__m128i *)(dst + o), _mm_or_si128(lead, _mm_slli_epi16(cont, 8)));
+                i += 8;
+                o += 16;
+                continue;
+            }
+            // copy the leading ASCII units and leave the next character to the scalar path
+            n = (size_t)(ctz(~(unsigned)ascii) / 2);
+            _mm_storel_epi64((__m128i *)(dst + o), _mm_packus_epi16(v, v));
+            i += n;
+            o += n;
+            break;
+        }
+        if(i >= len) break;
+#endif
+        at = i;
+        if(!(n = put_utf8(get_utf16(src, len, &i), dst + o, cap - o))) {
+            i = at;
+            break;
+        }
+        o += n;
+    }
+    *used = i;
+    return o;
+}
+
+static size_t utf32_conv(const uint32_t *src, size_t len, char *dst, size_t cap, size_t *used) {
+    size_t i = 0, o = 0;
+
+    while(i < len) {
+        size_t n;
+#if MULOG_UTF8_SSE2
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i not_ascii = _mm_set1_epi32((int)0xFFFFFF80u);
+        while(i + 8 <= len && o + 8 <= cap) {
+            __m128i a = _mm_loadu_si128((const __m128i *)(src + i));
+            __m128i b = _mm_loadu_si128((const __m128i *)(src + i + 4));
+            __m128i high = _mm_and_si128(_mm_or_si128(a, b), not_ascii);
+            if(_mm_movemask_epi8(_mm_cmpeq_epi32(high, zero)) != 0xFFFF) break;
+            _mm_storel_epi64((__m128i *)(dst + o), _mm_packus_epi16(_mm_packs_epi32(a, b), zero));
+            i += 8;
+            o += 8;
+        }
+        // ASCII units left in a mixed run are cheap on the scalar path
+        while(i < len && src[i] < 0x80 && o < cap) dst[o++] = (char)src[i++];
+        if(i >= len) break;
+#endif
+        if(!(n = put_utf8(get_utf32(src[i]), dst + o, cap - o))) break;
+        i++;
+        o += n;
+    }
+    *used = i;
+    return o;
+}
+
+size_t mulog_utf16_to_utf8(const uint16_t *src, size_t len, char *dst, size_t cap) {
+    size_t used;
+    return utf16_conv(src, len, dst, cap, &used);
+}
+
+size_t mulog_utf32_to_utf8(const uint32_t *src, size_t len, char *dst, size_t cap) {
+    size_t used;
+    return utf32_conv(src, len, dst, cap, &used);
+}
+
+/* Like vsnprintf for a UTF-16 (wide 0) or UTF-32 (wide 1) message: converts as much as fits in
+ * cap - 1 bytes, terminates it and returns the length of the whole message in UTF-8
+ */
+static int utf8_fmt(char *buf, size_t cap, int wide, const void *src, size_t len) {
+    size_t used = 0, n = 0;
+    if(cap) {
+        n = wide ? utf32_conv(src, len, buf, cap - 1, &used) : utf16_conv(src, len, buf, cap - 1, &used);
+        buf[n] = '\0';
+    }
+    // the rest only needs counting
+    if(wide) {
+        const uint32_t *s = src;
+        for(; used < len; used++) n += len_utf8(get_utf32(s[used]));
+    } else {
+        const uint16_t *s = src;
+        while(used < len) n += len_utf8(get_utf16(s, len, &used));
+    }
+    return n > INT_MAX ? -1 : (int)n;
+}
+
+/* =========
+ * Msg funcs
+ * =========
+ */
+
+mulog_status mulog_append(mulog_ref l, const char * str, size_t len) {
+
+}
+
+// formating helper func & constants
+const char* mulog_tc_long = "%c %Z";
+const char* mulog_tc_short = "%x %X %Z";
+const char* mulog_tc_fixed = "%Y-%m-%d %H:%M:%S";
+
+/* How each level is written, indexed by mulog_level */
+struct mulog_lvl {
+    const char *name;
+    size_t nlen;
+    int err;                    // whether con loggers write it to stderr
+    const char *uclr;           // Unix and Win32 console colors
+    size_t uclen;
+    Win32ConsoleColor wclr;
+};
+
+#define MULOG_UC(clr) clr, sizeof(clr) - 1
+#define MULOG_LN(name) name, sizeof(name) - 1
+
+static const struct mulog_lvl mulog_lvls[] = {
+    { MULOG_LN("VDEBUG:"), 0, MULOG_UC(mulog_uc_white), wfg_white },
+    { MULOG_LN("DEBUG:"), 0, MULOG_UC(mulog_uc_white), wfg_white },
+    { MULOG_LN("VINFO:"), 0, MULOG_UC(mulog_uc_cyan), wfg_cyan },
+    { MULOG_LN("INFO:"), 0, MULOG_UC(mulog_uc_cyan), wfg_cyan },
+    { MULOG_LN("WARNING:"), 1, MULOG_UC(mulog_uc_magenta), wfg_magenta },
+    { MULOG_LN("ERROR:"), 1, MULOG_UC(mulog_uc_red), wfg_red },
+    { MULOG_LN("CRITICAL:"), 1, MULOG_UC(mulog_uc_red), wfg_red },
+    { MULOG_LN("CATASTROPHIC:"), 1, MULOG_UC(mulog_uc_red), wfg_red }
+};
+
+/* Writes the time ttm in the given format to buf; returns the length written,
+ * or 0 if the format is invalid
+ */
+static size_t fmttime(char *buf, size_t len, mulog_timefmt fmt, time_t ttm) {
+    struct tm tmtm;
+
+    switch(fmt) {
+    case mulog_tm_long:
+#ifdef MULOG_UNIX
+        localtime_r(&ttm, &tmtm);
+#else
+        tmtm = *localtime(&ttm);
+#endif
+        return strftime(buf, len, mulog_tc_long, &tmtm);
+    case mulog_tm_short:
+#ifdef MULOG_UNIX
+        localtime_r(&ttm, &tmtm);
+#else
+        tmtm = *localtime(&ttm);
+#endif
+        return strftime(buf, len, mulog_tc_short, &tmtm);
+    case mulog_tm_fixed:
+#ifdef MULOG_UNIX
+        gmtime_r(&ttm, &tmtm);
+#else
+        tmtm = *gmtime(&ttm);
+#endif
+        return strftime(buf, len, mulog_tc_fixed, &tmtm);
+    default: return 0;
+    }
+}
+
+/* Message headers, "[time] LEVEL: ", are copied together from the time rendered by fmttime,
+ * which each thread caches for the second it was rendered for, and the level name
+ */
+#define MULOG_TM_MAX 128
+#define MULOG_HDR_MAX (MULOG_TM_MAX + 16)
+
+struct mulog_tmc {
+    time_t ttm;
+    size_t len;                 // of "[time] ", 0 until rendered
+    char buf[MULOG_TM_MAX];
+};
+static MULOG_TLS struct mulog_tmc mulog_tmc[mulog_tm_na];
+
+/* Writes the header for the time ttm and level lvl to buf, which must hold MULOG_HDR_MAX bytes;
+ * returns its length, or 0 if the time format is invalid
+ */
+static size_t fmthdr(char *buf, mulog_timefmt fmt, time_t ttm, mulog_level lvl) {
+    const struct mulog_lvl *lv = &mulog_lvls[lvl];
+    struct mulog_tmc *tc;
+
+    if((unsigned)fmt >= mulog_tm_na) return 0;
+    tc = &mulog_tmc[fmt];
+    if(!tc->len || tc->ttm != ttm) {
+        size_t n = fmttime(tc->buf + 1, MULOG_TM_MAX - 3, fmt, ttm);
+        if(!n) return 0;
+        tc->buf[0] = '[';
+        tc->buf[n + 1] = ']';
+        tc->buf[n + 2] = ' ';
+        tc->len = n + 3;
+        tc->ttm = ttm;
+    }
+    memcpy(buf, tc->buf, tc->len);
+    memcpy(buf + tc->len, lv->name, lv->nlen);
+    buf[tc->len + lv->nlen] = ' ';
+    return tc->len + lv->nlen + 1;
+}
+
+// the formats mulog_log_msg() and mulog_log_utf16/32() log with; sinks copy or convert their
+// message instead of formatting it. Their arguments are the call-site key (see mulog_log_from),
+// the length and the message.
+static const char mulog_raw_fmt[] = "%.*s";
+static const char mulog_utf16_fmt[] = "(UTF-16)";
+static const char mulog_utf32_fmt[] = "(UTF-32)";
+
+static int msg_preformatted(const char *str) {
+    return str == mulog_raw_fmt || str == mulog_utf16_fmt || str == mulog_utf32_fmt;
+}
+
+/* vsnprintf, except that a preformatted message from mulog_log_msg() is copied as it is, and
+ * one from mulog_log_utf16/32() is converted to UTF-8
+ */
+static int msgfmt(char *buf, size_t cap, const char *str, va_list va) {
+    if(msg_preformatted(str)) (void)va_arg(va, const char *);
+    if(str == mulog_utf16_fmt || str == mulog_utf32_fmt) {
+        size_t len = va_arg(va, size_t);
+        const void *msg = va_arg(va, const void *);
+        return utf8_fmt(buf, cap, str == mulog_utf32_fmt, msg, len);
+    }
+    if(str == mulog_raw_fmt) {
+        int len = va_arg(va, int);
+        const char *msg = va_arg(va, const char *);
+        size_t n = len < 0 ? 0 : (size_t)len;
+        if(cap) {
+            if(n > cap - 1) n = cap - 1;
+            memcpy(buf, msg, n);
+            buf[n] = '\0';
+        }
+        return len;
+    }
+    return vsnprintf(buf, cap, str, va);
+}
+
+/* Formats "[time] LEVEL: context message\n" for the time ttm into a record buffer
+ * Returns the record, to be released with mulog_rec_release(), and stores its length in *len;
+ * returns NULL if the time format is invalid or no buffer is available
+ */
+static char *fmtrec(mulog_timefmt fmt, time_t ttm, mulog_level lvl, const char* str, va_list va, size_t *len) {
+    char hdr[MULOG_HDR_MAX];
+    size_t hlen = fmthdr(hdr, fmt, ttm, lvl);
+    va_list vasc;
+    size_t cap, h;
+    char *rec;
+    int n;
+
+    if(!hlen) return NULL;
+    if(!(rec = mulog_rec_acquire(0, &cap))) return NULL;
+
+    for(;;) {
+        h = hlen + mulog_ctx.len;
+        if(h < cap) {
+            memcpy(rec, hdr, hlen);
+            memcpy(rec + hlen, mulog_ctx.buf, mulog_ctx.len);
+        }
         va_copy(vasc, va);
-        mulog_vinfo(l->left, str, va);
-        mulog_vinfo(l->right, str, vasc);
+        n = msgfmt(h < cap ? rec + h : NULL, h < cap ? cap - h : 0, str, vasc);
         va_end(vasc);
-        return;
-    default: return;
+        if(n < 0) break;
+        // +1 for the newline, which replaces vsnprintf's terminator
+        if(h + n + 1 <= cap) {
+            rec[h + n] = '\n';
+            *len = h + n + 1;
+            return rec;
+        }
+        mulog_rec_release(rec);
+        if(!(rec = mulog_rec_acquire(h + n + 1, &cap))) return NULL;
     }
+    mulog_rec_release(rec);
+    return NULL;
 }
-void mulog_info(mulog_ref l, const char* str, ...) {
-    va_list va;
-    va_start(va, str);
-    mulog_vinfo(l, str, va);
-    va_end(va);
+
+static void logstr(FILE *to, mulog_timefmt fmt, mulog_level lvl, const char* str, va_list va) {
+    size_t len;
+    char *rec = fmtrec(fmt, time(NULL), lvl, str, va, &len);
+
+    if(!rec) return;
+    fwrite(rec, 1, len, to);
+    mulog_rec_release(rec);
 }
 
-void mulog_vdbg(mulog_ref l, const char* str, va_list va) {
-    if(!l) return;
+/* ==========
+ * Index sink
+ * ==========
+ * A file logger with an index attached accounts for the bytes it writes in blocks of about
+ * idx->every bytes; when a block fills up (or the logger is flushed) an entry describing it
+ * is appended to the index file.
+ */
+
+// must be called with the log file locked
+static void idx_close(const struct mulog_cfg *c) {
+    struct mulog_idx *x = c->idx;
+    long end;
+    if(!x->ent.levels) return;
+    end = ftell(c->fh);
+    x->ent.length = end > 0 && (uint64_t)end > x->ent.offset ? (uint64_t)end - x->ent.offset : x->bytes;
+    fwrite(&x->ent, sizeof(x->ent), 1, x->fh);
+    x->ent.levels = 0;
+    x->bytes = 0;
+}
+
+static void idx_add(const struct mulog_cfg *c, mulog_level lvl, time_t ttm, size_t len, long start) {
+    struct mulog_idx *x = c->idx;
+    if(!x->ent.levels) {
+        x->ent.offset = start > 0 ? (uint64_t)start : 0;
+        x->ent.first_ts = (int64_t)ttm;
+    }
+    x->ent.last_ts = (int64_t)ttm;
+    x->ent.levels |= 1u << lvl;
+    x->bytes += len;
+    if(x->bytes >= x->every) idx_close(c);
+}
+
+// closes the last block of the index of c and frees it
+static void idx_detach(struct mulog_cfg *c) {
+#ifdef MULOG_UNIX
+    flockfile(c->fh);
+#endif
+    idx_close(c);
+#ifdef MULOG_UNIX
+    funlockfile(c->fh);
+#endif
+    fflush(c->idx->fh);
+    free(c->idx);
+}
+
+/* Outputs a message on a file logger */
+static void filelogstr(mulog_ref l, const struct mulog_cfg *c, mulog_level lvl, const char* str, va_list va) {
+    time_t ttm = time(NULL);
+    size_t len;
+    char *rec = fmtrec(c->timefmt, ttm, lvl, str, va, &len);
+
+    if(!rec) return;
+    if(c->idx) {
+#ifdef MULOG_UNIX
+        flockfile(c->fh);
+#endif
+        long start = c->idx->ent.levels ? 0 : ftell(c->fh);
+        fwrite(rec, 1, len, c->fh);
+        idx_add(c, lvl, ttm, len, start);
+#ifdef MULOG_UNIX
+        funlockfile(c->fh);
+#endif
+    } else fwrite(rec, 1, len, c->fh);
+    mulog_rec_release(rec);
+}
+
+static void fileflush(mulog_ref l, const struct mulog_cfg *c) {
+    if(c->idx) {
+#ifdef MULOG_UNIX
+        flockfile(c->fh);
+#endif
+        idx_close(c);
+#ifdef MULOG_UNIX
+        funlockfile(c->fh);
+#endif
+        fflush(c->idx->fh);
+    }
+    if(c->fh) fflush(c->fh);
+}
+
+/* ============
+ * Console sink
+ * ============
+ * On Unix, all con loggers share one batch buffer that is written to the stdout or stderr
+ * file descriptor with a single write() call. The batch only ever holds output for one
+ * stream; switching streams flushes it first, so the relative order of stdout and stderr
+ * output is preserved. stderr, and a TTY stdout, are flushed after every message; stdout to
+ * a pipe or file is only flushed when the batch is full, when the stream changes, or on
+ * mulog_flush().
+ * Color is only used on TTY streams, and consecutive messages of the same color share
+ * one escape sequence.
+ */
+#ifdef MULOG_UNIX
+
+#define MULOG_CON_BUFSZ 8192
+
+struct mulog_con_sink {
+    pthread_mutex_t mtx;
+    int atexit;         // whether the atexit flush handler has been registered
+    int tty[2];         // whether stdout (0) and stderr (1) are terminals
+    int strm;           // stream the batch is bound for (0 -- stdout, 1 -- stderr)
+    const char *clr;    // escape sequence in effect at the end of the batch, or NULL
+    size_t len;
+    char buf[MULOG_CON_BUFSZ];
+};
+static struct mulog_con_sink mulog_con = { PTHREAD_MUTEX_INITIALIZER, 0, { 0, 0 }, 0, NULL, 0 };
+
+// usable batch capacity; room for the trailing reset sequence is always kept in reserve
+#define MULOG_CON_CAP (MULOG_CON_BUFSZ - sizeof(mulog_uc_reset))
+
+static void con_write(int strm, const char *buf, size_t len) {
+    int fd = strm ? STDERR_FILENO : STDOUT_FILENO;
+    while(len) {
+        ssize_t n = write(fd, buf, len);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            return;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+}
+
+// must be called with mulog_con.mtx held
+static void con_flush(void) {
+    if(!mulog_con.len) return;
+    if(mulog_con.clr) {
+        memcpy(mulog_con.buf + mulog_con.len, mulog_uc_reset, sizeof(mulog_uc_reset) - 1);
+        mulog_con.len += sizeof(mulog_uc_reset) - 1;
+        mulog_con.clr = NULL;
+    }
+    con_write(mulog_con.strm, mulog_con.buf, mulog_con.len);
+    mulog_con.len = 0;
+}
+
+/* Keeps batched output in order with anything the client wrote to stdout or stderr through stdio
+ * Must be called with mulog_con.mtx held, after binding the batch to strm and before appending to it
+ */
+static void con_sync(int strm) {
+    FILE *f = strm ? stderr : stdout;
+    FILE *o = strm ? stdout : stderr;
+#ifdef __GLIBC__
+    if(__fpending(o)) fflush(o);
+    if(__fpending(f)) {
+        con_flush();
+        fflush(f);
+    }
+#else
+    if(!mulog_con.len) {
+        fflush(o);
+        fflush(f);
+    }
+#endif
+}
+
+static void con_atexit(void) {
+    pthread_mutex_lock(&mulog_con.mtx);
+    con_flush();
+    pthread_mutex_unlock(&mulog_con.mtx);
+}
+
+static void con_init(void) {
+    pthread_mutex_lock(&mulog_con.mtx);
+    con_flush();
+    mulog_con.tty[0] = isatty(STDOUT_FILENO);
+    mulog_con.tty[1] = isatty(STDERR_FILENO);
+    if(!mulog_con.atexit) mulog_con.atexit = !atexit(con_atexit);
+    pthread_mutex_unlock(&mulog_con.mtx);
+}
+
+// appends a color change to the batch if needed; returns 0 if it doesn't fit
+static int con_setclr(const char *clr, size_t clen) {
+    if(clr == mulog_con.clr) return 1;
+    if(!clr) {
+        clr = mulog_uc_reset;
+        clen = sizeof(mulog_uc_reset) - 1;
+    }
+    if(mulog_con.len + clen > MULOG_CON_CAP) return 0;
+    memcpy(mulog_con.buf + mulog_con.len, clr, clen);
+    mulog_con.len += clen;
+    mulog_con.clr = clr == mulog_uc_reset ? NULL : clr;
+    return 1;
+}
+
+// appends a whole message to the batch; returns 0 (leaving the batch untouched) if it doesn't fit
+static int con_put(const char *clr, size_t clen, const char *hdr, size_t hlen, const char* str, va_list va) {
+    size_t start = mulog_con.len;
+    const char *prevclr = mulog_con.clr;
     va_list vasc;
-    switch(l->type) {
-    case mulog_t_file:
-        if(l->flag & mulog_f_wdbg) logstr(l->fh, l->timefmt, mulog_s_dbg, str, va);
-        return;
-    case mulog_t_con:
-        if(l->flag & mulog_f_wdbg) {
-            if(l->flag & mulog_f_wclr) UnixConClrSet(stdout, u_white, 1, u_none, 0);
-            if(l->flag & mulog_f_wclr) Win32ConClrSet(stdout, wfg_white, wbg_black);
-            logstr(stdout, l->timefmt, mulog_s_dbg, str, va);
-            if(l->flag & mulog_f_wclr) Win32ConClrReset(stdout);
-            if(l->flag & mulog_f_wclr) UnixConClrReset(stdout);
+    int n;
+
+    if(con_setclr(clr, clen)) {
+        if(mulog_con.len + hlen + mulog_ctx.len < MULOG_CON_CAP) {
+            memcpy(mulog_con.buf + mulog_con.len, hdr, hlen);
+            mulog_con.len += hlen;
+            memcpy(mulog_con.buf + mulog_con.len, mulog_ctx.buf, mulog_ctx.len);
+            mulog_con.len += mulog_ctx.len;
+            va_copy(vasc, va);
+            n = msgfmt(mulog_con.buf + mulog_con.len, MULOG_CON_CAP - mulog_con.len, str, vasc);
+            va_end(vasc);
+            // +1 for the newline, which replaces vsnprintf's terminator
+            if(n >= 0 && mulog_con.len + n + 1 <= MULOG_CON_CAP) {
+                mulog_con.len += n;
+                mulog_con.buf[mulog_con.len++] = '\n';
+                return 1;
+            }
         }
-        return;
-    case mulog_t_split:
+    }
+    mulog_con.len = start;
+    mulog_con.clr = prevclr;
+    return 0;
+}
+
+// writes a message too large for the batch buffer; the batch must be empty
+static void con_put_large(int strm, const char *clr, size_t clen, const char *hdr, size_t hlen, const char* str, va_list va) {
+    va_list vasc;
+    char *msg;
+    int n;
+
+    con_setclr(clr, clen);
+    con_write(strm, mulog_con.buf, mulog_con.len);
+    con_write(strm, hdr, hlen);
+    con_write(strm, mulog_ctx.buf, mulog_ctx.len);
+    mulog_con.len = 0;
+
+    va_copy(vasc, va);
+    n = msgfmt(NULL, 0, str, vasc);
+    va_end(vasc);
+    if(n > 0 && (msg = mulog_rec_acquire((size_t)n + 1, NULL))) {
         va_copy(vasc, va);
-        mulog_vdbg(l->left, str, va);
-        mulog_vdbg(l->right, str, vasc);
+        msgfmt(msg, (size_t)n + 1, str, vasc);
         va_end(vasc);
+        con_write(strm, msg, (size_t)n);
+        mulog_rec_release(msg);
+    }
+    mulog_con.buf[mulog_con.len++] = '\n';
+}
+
+#endif // MULOG_UNIX
+
+/* Outputs a message on a console logger, in the stream and color given by its level */
+static void conlogstr(mulog_ref l, const struct mulog_cfg *c, mulog_level lvl, const char* str, va_list va) {
+    const struct mulog_lvl *lv = &mulog_lvls[lvl];
+    int err = lv->err;
+#ifdef MULOG_UNIX
+    const char *uclr = lv->uclr;
+    size_t uclen = lv->uclen;
+    char hdr[MULOG_HDR_MAX];
+    size_t hlen = fmthdr(hdr, c->timefmt, time(NULL), lvl);
+
+    if(!hlen) return;
+
+    pthread_mutex_lock(&mulog_con.mtx);
+    if(mulog_con.len && mulog_con.strm != err) con_flush();
+    mulog_con.strm = err;
+    con_sync(err);
+    if(!(c->flag & mulog_f_wclr) || !mulog_con.tty[err]) uclr = NULL;
+    if(!con_put(uclr, uclen, hdr, hlen, str, va)) {
+        con_flush();
+        if(!con_put(uclr, uclen, hdr, hlen, str, va)) con_put_large(err, uclr, uclen, hdr, hlen, str, va);
+    }
+    // stderr output (warnings and above) goes out at once, as it would unbuffered, so that
+    // a message logged just before a crash isn't lost
+    if(err || mulog_con.tty[err]) con_flush();
+    pthread_mutex_unlock(&mulog_con.mtx);
+#else
+    FILE *f = err ? stderr : stdout;
+    if(c->flag & mulog_f_wclr) Win32ConClrSet(f, lv->wclr, wbg_black);
+    logstr(f, c->timefmt, lvl, str, va);
+    if(c->flag & mulog_f_wclr) Win32ConClrReset(f);
+#endif
+}
+
+static void conflush(mulog_ref l, const struct mulog_cfg *c) {
+#ifdef MULOG_UNIX
+    pthread_mutex_lock(&mulog_con.mtx);
+    con_flush();
+    pthread_mutex_unlock(&mulog_con.mtx);
+#else
+    fflush(stdout);
+    fflush(stderr);
+#endif
+}
+
+/* Outputs a message on a shared-memory ring logger (see mulog_shm.h)
+ * The line is formatted straight into the claimed slot and truncated to the slot size
+ */
+static void shmlogstr(mulog_ref l, const struct mulog_cfg *c, mulog_level lvl, const char* str, va_list va) {
+#ifdef MULOG_UNIX
+    mulog_shm_ring *r = l->ring;
+    mulog_shm_slot *slot;
+    char hdr[MULOG_HDR_MAX];
+    size_t hlen = fmthdr(hdr, c->timefmt, time(NULL), lvl);
+    uint64_t pos, own;
+    size_t len;
+    char *data;
+    va_list vasc;
+    int n;
+
+    if(!hlen) return;
+
+    pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+    do {
+        if(pos - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= r->slot_count) {
+            __atomic_add_fetch(&r->dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    } while(!__atomic_compare_exchange_n(&r->head, &pos, pos + 1, 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    // fails only if the collector timed out waiting for this slot to be owned and took it back
+    slot = mulog_shm_slot_at(r, pos);
+    own = MULOG_SHM_OWNER(pos, 0);
+    if(!__atomic_compare_exchange_n(&slot->owner, &own, MULOG_SHM_OWNER(pos, mulog_shm_pid), 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        __atomic_add_fetch(&r->dropped, 1, __ATOMIC_RELAXED);
         return;
-    default: return;
     }
+    data = mulog_shm_data(slot);
+
+    len = hlen < r->slot_size ? hlen : r->slot_size - 1;
+    memcpy(data, hdr, len);
+    n = (int)(mulog_ctx.len < r->slot_size - 1 - len ? mulog_ctx.len : r->slot_size - 1 - len);
+    memcpy(data + len, mulog_ctx.buf, (size_t)n);
+    len += (size_t)n;
+    va_copy(vasc, va);
+    n = msgfmt(data + len, r->slot_size - len, str, vasc);
+    va_end(vasc);
+    len += n < 0 ? 0 : (size_t)n < r->slot_size - len ? (size_t)n : r->slot_size - len - 1;
+    // the newline takes the terminator's place, or the last byte of a truncated line
+    data[len++] = '\n';
+    slot->len = (uint32_t)len;
+
+    // fails only if the collector took this producer for dead and recovered the slot
+    if(!__atomic_compare_exchange_n(&slot->seq, &pos, pos + 1, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        __atomic_add_fetch(&r->dropped, 1, __ATOMIC_RELAXED);
+#endif
+}
+
+// the current time in microseconds since the epoch
+static int64_t col_now(void) {
+#ifdef MULOG_UNIX
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+    return (int64_t)time(NULL) * 1000000;
+#endif
+}
+
+// writes len bytes at offset *off of the segment, and advances *off past them
+static void col_put(struct mulog_col *b, const void *p, size_t len, uint64_t *off) {
+    fwrite(p, 1, len, b->fh);
+    *off += len;
+}
+
+// ends a column: writes zeroes up to the next 8-byte boundary
+static void col_pad(struct mulog_col *b, uint64_t *off) {
+    static const char zero[8] = { 0 };
+    fwrite(zero, 1, (size_t)(-*off & 7), b->fh);
+    *off = (*off + 7) & ~(uint64_t)7;
+}
+
+// writes out the records buffered by a column logger as one segment, and starts a new one
+static void col_write(struct mulog_col *b) {
+    mulog_col_header h = { MULOG_COL_MAGIC, MULOG_COL_VERSION, 0 };
+    mulog_col_footer f;
+    uint64_t off = sizeof(h);
+    uint32_t i, n = b->n;
+
+    memset(&f, 0, sizeof(f));
+    f.count = n;
+    f.dict_count = b->ndict;
+    f.levels = b->levels;
+    f.ts_min = f.ts_max = b->ts[0];
+    for(i = 1; i < n; i++) {
+        if(b->ts[i] < f.ts_min) f.ts_min = b->ts[i];
+        if(b->ts[i] > f.ts_max) f.ts_max = b->ts[i];
+    }
+    for(i = 0; !(b->levels >> i & 1); i++);
+    f.level_min = (uint8_t)i;
+    for(i = mulog_l_catastrophic; !(b->levels >> i & 1); i--);
+    f.level_max = (uint8_t)i;
+    f.version = MULOG_COL_VERSION;
+    f.magic = MULOG_COL_MAGIC;
+
+    // every length is known up front, so the header can go first
+    f.ts_off = off;
+    f.lvl_off = f.ts_off + n * sizeof(int64_t);
+    f.cat_off = f.lvl_off + ((n + 7) & ~(uint64_t)7);
+    f.pay_off = f.cat_off + ((n * sizeof(uint16_t) + 7) & ~(uint64_t)7);
+    f.pay_len = (n + 1) * sizeof(uint32_t) + b->pay_off[n];
+    f.ctx_off = f.pay_off + ((f.pay_len + 7) & ~(uint64_t)7);
+    f.ctx_len = (n + 1) * sizeof(uint32_t) + b->ctx_off[n];
+    f.dict_off = f.ctx_off + ((f.ctx_len + 7) & ~(uint64_t)7);
+    f.dict_len = (b->ndict + 1) * sizeof(uint32_t) + b->dict_off[b->ndict];
+    h.seg_len = f.dict_off + ((f.dict_len + 7) & ~(uint64_t)7) + sizeof(f);
+
+    for(i = n - 1; i > 0; i--) b->ts[i] -= b->ts[i - 1];
+    fwrite(&h, sizeof(h), 1, b->fh);
+    col_put(b, b->ts, n * sizeof(int64_t), &off);
+    col_put(b, b->lvl, n, &off);
+    col_pad(b, &off);
+    col_put(b, b->cat, n * sizeof(uint16_t), &off);
+    col_pad(b, &off);
+    col_put(b, b->pay_off, (n + 1) * sizeof(uint32_t), &off);
+    col_put(b, b->pay, b->pay_off[n], &off);
+    col_pad(b, &off);
+    col_put(b, b->ctx_off, (n + 1) * sizeof(uint32_t), &off);
+    col_put(b, b->ctx, b->ctx_off[n], &off);
+    col_pad(b, &off);
+    col_put(b, b->dict_off, (b->ndict + 1) * sizeof(uint32_t), &off);
+    col_put(b, b->dict, b->dict_off[b->ndict], &off);
+    col_pad(b, &off);
+    fwrite(&f, sizeof(f), 1, b->fh);
+
+    b->n = 0;
+    b->levels = 0;
+    b->ndict = 0;
+    memset(b->fmt_key, 0, (b->fmt_mask + 1) * sizeof(const char *));
+}
+
+/* Returns the dictionary id of category str in the current segment, adding it if it's new,
+ * or -1 if there's no room left for it
+ * Categories are looked up by address and compared, since a format built in a buffer may have
+ * changed since it was last logged.
+ */
+static int col_category(struct mulog_col *b, const char *str) {
+    uint32_t h = (uint32_t)(((uintptr_t)str >> 3) * 2654435761u) & b->fmt_mask;
+    size_t len;
+    while(b->fmt_key[h]) {
+        if(b->fmt_key[h] == str && !strcmp(b->dict + b->dict_off[b->fmt_id[h]], str)) return b->fmt_id[h];
+        h = (h + 1) & b->fmt_mask;
+    }
+    len = strlen(str) + 1;
+    if(len > b->dict_cap - b->dict_off[b->ndict]) return -1;
+    memcpy(b->dict + b->dict_off[b->ndict], str, len);
+    b->dict_off[b->ndict + 1] = b->dict_off[b->ndict] + (uint32_t)len;
+    b->fmt_key[h] = str;
+    b->fmt_id[h] = (uint16_t)b->ndict;
+    return (int)b->ndict++;
+}
+
+/* Outputs a message on a column logger: appends a record to the current segment, and writes the
+ * segment out once it is full, or first if the record doesn't fit in it
+ * The record's category is its format string, or the key a preformatted message was logged
+ * with; the thread's context goes in the context column, without its trailing space. A message
+ * longer than a whole segment's payload bytes is truncated, and one whose category is longer
+ * than the dictionary is dropped. Other threads logging to the same logger wait while a
+ * segment is written.
+ */
+static void collogstr(mulog_ref l, const struct mulog_cfg *c, mulog_level lvl, const char* str, va_list va) {
+    struct mulog_col *b = l->col;
+    const char *key = str;
+    size_t clen = mulog_ctx.len ? mulog_ctx.len - 1 : 0;
+    va_list vasc;
+    size_t used, cused;
+    int id = -1, n;
+
+    if(msg_preformatted(str)) {
+        va_copy(vasc, va);
+        if(!(key = va_arg(vasc, const char *))) key = str;
+        va_end(vasc);
+    }
+
+    pool_lock(&b->lock);
+    for(;;) {
+        used = b->pay_off[b->n];
+        cused = b->ctx_off[b->n];
+        va_copy(vasc, va);
+        n = msgfmt(b->pay + used, b->pay_cap - used, str, vasc);
+        va_end(vasc);
+        if(n < 0) goto out;
+        // an empty segment always has room for the context (MULOG_CTX_BUFSZ bytes at most)
+        if(!b->n && (size_t)n >= b->pay_cap) n = (int)b->pay_cap - 1;
+        if(cused + clen <= b->ctx_cap && (size_t)n < b->pay_cap - used && (id = col_category(b, key)) >= 0) break;
+        if(!b->n) goto out;
+        col_write(b);
+    }
+
+    memcpy(b->ctx + cused, mulog_ctx.buf, clen);
+    b->ts[b->n] = col_now();
+    b->lvl[b->n] = (uint8_t)lvl;
+    b->cat[b->n] = (uint16_t)id;
+    b->ctx_off[b->n + 1] = (uint32_t)(cused + clen);
+    b->pay_off[++b->n] = (uint32_t)(used + (size_t)n);
+    b->levels |= 1u << lvl;
+    if(b->n == b->cap) col_write(b);
+out:
+    pool_unlock(&b->lock);
 }
+
+static void colflush(mulog_ref l, const struct mulog_cfg *c) {
+    struct mulog_col *b = l->col;
+    pool_lock(&b->lock);
+    if(b->n) col_write(b);
+    fflush(b->fh);
+    pool_unlock(&b->lock);
+}
+
+// writes out a column logger's last records and frees it
+static void col_close(struct mulog_col *b) {
+    if(b->n) col_write(b);
+    lock_destroy(&b->lock);
+    free(b);
+}
+
+/* Sends a message on to both sink loggers of a split logger */
+static void splitlogstr(mulog_ref l, const struct mulog_cfg *c, mulog_level lvl, const char* str, va_list va) {
+    va_list vasc;
+    va_copy(vasc, va);
+    mulog_vlog(c->left, lvl, str, va);
+    mulog_vlog(c->right, lvl, str, vasc);
+    va_end(vasc);
+}
+
+static void splitflush(mulog_ref l, const struct mulog_cfg *c) {
+    mulog_flush(c->left);
+    mulog_flush(c->right);
+}
+
+/* Sink operations, indexed by mulog_type; the messaging functions dispatch through these */
+struct mulog_ops {
+    void (*log)(mulog_ref l, const struct mulog_cfg *c, mulog_level lvl, const char* str, va_list va);
+    void (*flush)(mulog_ref l, const struct mulog_cfg *c);
+};
+
+static const struct mulog_ops mulog_ops[] = {
+    { filelogstr, fileflush },      // mulog_t_file
+    { conlogstr, conflush },        // mulog_t_con
+    { splitlogstr, splitflush },    // mulog_t_split
+    { NULL, NULL },                 // mulog_t_dummy
+    { shmlogstr, NULL },            // mulog_t_shm
+    { collogstr, colflush }         // mulog_t_col
+};
+
+mulog_status mulog_flush(mulog_ref l) {
+    const struct mulog_ops *ops;
+    struct mulog_cfg *c;
+    if(!l) return mulog_ok;
+    ops = &mulog_ops[l->type];
+    if(!ops->flush || !(c = cfg_enter(l))) return mulog_ok;
+    ops->flush(l, c);
+    cfg_leave();
+    return mulog_ok;
+}
+
+// logs a message whose backtrace, if any, starts at the frame from returns to (see trace_push)
+static void vlog(mulog_ref l, mulog_level lvl, const void *from, const char* str, va_list va) {
+    const struct mulog_ops *ops;
+    struct mulog_cfg *c;
+    int traced;
+    // checked before anything else, so a filtered message costs a load and a compare
+    if(!l || (unsigned)lvl > mulog_l_catastrophic || lvl < __atomic_load_n(&l->min, __ATOMIC_RELAXED)) return;
+    ops = &mulog_ops[l->type];
+    if(!ops->log || !(c = cfg_enter(l))) return;
+    // captured once per message, not once per split sink
+    traced = lvl >= mulog_l_error && mulog_rd_nest == 1 && trace_push(from);
+    ops->log(l, c, lvl, str, va);
+    if(traced) mulog_ctx_pop();
+    cfg_leave();
+}
+
+static void log_from(mulog_ref l, mulog_level lvl, const void *from, const char* str, ...) {
+    va_list va;
+    va_start(va, str);
+    vlog(l, lvl, from, str, va);
+    va_end(va);
+}
+
+void mulog_vlog(mulog_ref l, mulog_level lvl, const char* str, va_list va) {
+    vlog(l, lvl, MULOG_CALLER, str, va);
+}
+void mulog_log(mulog_ref l, mulog_level lvl, const char* str, ...) {
+    va_list va;
+    va_start(va, str);
+    vlog(l, lvl, MULOG_CALLER, str, va);
+    va_end(va);
+}
+
+// function definitions of the macros in mulog.h, for callers that don't use the macros
+void (mulog_verr)(mulog_ref l, const char* str, va_list va) {
+    vlog(l, mulog_l_error, MULOG_CALLER, str, va);
+}
+
+void (mulog_vwarn)(mulog_ref l, const char* str, va_list va) {
+    vlog(l, mulog_l_warning, MULOG_CALLER, str, va);
+}
+
+void (mulog_vinfo)(mulog_ref l, const char* str, va_list va) {
+    vlog(l, mulog_l_info, MULOG_CALLER, str, va);
+}
+
+void (mulog_vdbg)(mulog_ref l, const char* str, va_list va) {
+    vlog(l, mulog_l_debug, MULOG_CALLER, str, va);
+}
+
+void mulog_err(mulog_ref l, const char* str, ...) {
+    va_list va;
+    va_start(va, str);
+    vlog(l, mulog_l_error, MULOG_CALLER, str, va);
+    va_end(va);
+}
+
+void mulog_warn(mulog_ref l, const char* str, ...) {
+    va_list va;
+    va_start(va, str);
+    vlog(l, mulog_l_warning, MULOG_CALLER, str, va);
+    va_end(va);
+}
+
+void mulog_info(mulog_ref l, const char* str, ...) {
+    va_list va;
+    va_start(va, str);
+    vlog(l, mulog_l_info, MULOG_CALLER, str, va);
+    va_end(va);
+}
+
 void mulog_dbg(mulog_ref l, const char* str, ...) {
     va_list va;
     va_start(va, str);
-    mulog_vdbg(l, str, va);
+    vlog(l, mulog_l_debug, MULOG_CALLER, str, va);
     va_end(va);
 }
 
+void mulog_log_from(mulog_ref l, mulog_level lvl, const void *from, const char *key, mulog_enc enc, const void *msg, size_t len) {
+    switch(enc) {
+    case mulog_enc_utf16: log_from(l, lvl, from, mulog_utf16_fmt, key, len, msg); break;
+    case mulog_enc_utf32: log_from(l, lvl, from, mulog_utf32_fmt, key, len, msg); break;
+    default: log_from(l, lvl, from, mulog_raw_fmt, key, (int)len, (const char *)msg); break;
+    }
+}
+
+void mulog_log_msg(mulog_ref l, mulog_level lvl, const char *msg, size_t len) {
+    log_from(l, lvl, MULOG_CALLER, mulog_raw_fmt, (const char *)NULL, (int)len, msg);
+}
+
+void mulog_log_utf16(mulog_ref l, mulog_level lvl, const uint16_t *msg, size_t len) {
+    log_from(l, lvl, MULOG_CALLER, mulog_utf16_fmt, (const char *)NULL, len, (const void *)msg);
+}
+
+void mulog_log_utf32(mulog_ref l, mulog_level lvl, const uint32_t *msg, size_t len) {
+    log_from(l, lvl, MULOG_CALLER, mulog_utf32_fmt, (const char *)NULL, len, (const void *)msg);
+}
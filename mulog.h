@@ -26,6 +26,7 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -43,16 +44,24 @@ enum mulog_type {
     mulog_t_file,       // outputs to a C file handle
     mulog_t_con,        // outputs to the terminal/console, optionally with color
     mulog_t_split,      // sends messages to two different mulog objects
-    mulog_t_dummy       // no-op mulog object
+    mulog_t_dummy,      // no-op mulog object
+    mulog_t_shm,        // appends to a shared-memory ring drained by mulog_collectd
+    mulog_t_col         // writes records to a file in columnar segments (see mulog_col.h)
 };
 typedef enum mulog_type mulog_type;
 
-/* Indicates the different logging levels */
+/* Indicates the different logging levels, in increasing order of severity
+ * They match the C++ interface's Severity values.
+ */
 enum mulog_level {
+	mulog_l_vdebug,
 	mulog_l_debug,
+	mulog_l_vinfo,
 	mulog_l_info,
 	mulog_l_warning,
-	mulog_l_error
+	mulog_l_error,
+	mulog_l_critical,
+	mulog_l_catastrophic
 };
 typedef enum mulog_level mulog_level;
 
@@ -68,18 +77,124 @@ typedef enum mulog_timefmt mulog_timefmt;
 enum mulog_status {
     mulog_ok,           // indicates operation success
     mulog_err_type,     // indicates an operation performed on an invalid logger type
-    mulog_err_inval     // indicates an invalid parameter
+    mulog_err_inval,    // indicates an invalid parameter
+    mulog_err_nomem     // indicates that memory for the operation could not be obtained
 };
 typedef enum mulog_status mulog_status;
 
+/* ===============================
+ * Memory pool and arena functions
+ * ===============================
+ */
+
+/* Sets up the pool of record buffers that messages are formatted into
+ * rec_count buffers of rec_size bytes are allocated up front, and each thread caches up to
+ * per_thread of them on a private free list. large_count buffers of large_size bytes are
+ * kept for messages that don't fit in a record; messages that fit neither fall back to malloc.
+ * Must be called once, before any message is logged; otherwise a small default pool is set
+ * up on first use. Returns mulog_err_inval if the pool is already set up.
+ */
+mulog_status mulog_pool_init(size_t rec_size, size_t rec_count, size_t per_thread, size_t large_size, size_t large_count);
+
+/* Returns the number of record buffers that had to be taken from the heap since startup */
+unsigned long mulog_pool_heap_allocs(void);
+
+/* Returns a record buffer of at least len bytes and stores its actual size in *cap (if not NULL)
+ * Returns NULL only if the pool is exhausted and the heap fallback fails
+ */
+char *mulog_rec_acquire(size_t len, size_t *cap);
+/* Returns a record buffer obtained from mulog_rec_acquire; may be called from any thread */
+void mulog_rec_release(char *rec);
+
+/* Makes all loggers created from now on be allocated from the size bytes at mem, which must
+ * outlive them; the creation functions return mulog_err_nomem once the arena is full
+ * Must not be called while other threads are creating or destroying loggers.
+ * mulog_arena_size returns the number of bytes needed for the given number of loggers, with
+ * room for reconfiguring one at a time (each logger also keeps its configuration in the arena)
+ */
+mulog_status mulog_arena_init(void *mem, size_t size);
+size_t mulog_arena_size(size_t nloggers);
+
+/* =================
+ * Context functions
+ * =================
+ * Each thread has a stack of context fields (e.g. a request ID or tenant) that is written
+ * into every message it logs, between the level and the message text: "[time] LEVEL: k=v ...".
+ * A field is rendered once, when it is pushed, so logging only copies the rendered prefix.
+ */
+
+/* Pushes the field "key=value" (or just "value" if key is NULL) onto the calling thread's context
+ * Returns mulog_err_nomem if the context is full (512 bytes or 16 fields); the field is then left
+ * out, but the push must still be matched by a mulog_ctx_pop() like any other.
+ */
+mulog_status mulog_ctx_push(const char *key, const char *value);
+/* Removes the most recently pushed field from the calling thread's context */
+void mulog_ctx_pop(void);
+
+/* Returns the calling thread's rendered context (not NUL-terminated) and stores its length in *len */
+const char *mulog_ctx_prefix(size_t *len);
+/* For sinks that keep fields apart: returns the number of fields in the calling thread's context,
+ * and (by index, outermost first) their keys and values, which are not NUL-terminated.
+ * A field pushed without a key has a key length of 0.
+ */
+size_t mulog_ctx_count(void);
+mulog_status mulog_ctx_field(size_t i, const char **key, size_t *klen, const char **value, size_t *vlen);
+
+/* ==========
+ * Backtraces
+ * ==========
+ */
+
+/* Attaches a backtrace of up to depth (at most 32) frames to every error message logged from
+ * now on, as the context field "bt"
+ * Only return addresses are captured while logging, which takes a few microseconds. If out is
+ * not NULL the field holds a trace number, and a background thread symbolizes the trace and
+ * writes it to out as lines of the form "[bt=N] #frame module(symbol+offset) [address]".
+ * Otherwise, or if the background thread falls behind, the field holds the return addresses,
+ * separated by commas, as "module+0xoffset" with the offset from the module's load address
+ * (e.g. for addr2line -e module); addresses in modules loaded after this call are written as
+ * they are. Frames that don't fit in the thread's context (see mulog_ctx_push) are dropped,
+ * outermost first.
+ * Returns mulog_err_inval if tracing is already on, or mulog_err_type where backtraces aren't
+ * supported (they need glibc).
+ */
+mulog_status mulog_trace_start(int depth, FILE *out);
+/* Stops attaching backtraces, and waits until all pending traces have been written out */
+void mulog_trace_stop(void);
+
+/* =================
+ * Index file format
+ * =================
+ * An index file holds a header followed by one entry per block of the log file, in native
+ * byte order. Entries only describe messages logged through the indexing logger.
+ */
+#define MULOG_IDX_VERSION 2     // version 1 used the 4-level numbering (debug, info, warning, error)
+
+struct mulog_idx_header {
+    char magic[4];          // "MLIX"
+    uint32_t version;       // MULOG_IDX_VERSION
+    uint64_t block_size;    // nominal block size in bytes
+};
+typedef struct mulog_idx_header mulog_idx_header;
+
+struct mulog_idx_entry {
+    uint64_t offset;        // byte offset of the block's first message in the log file
+    uint64_t length;        // length of the block in bytes
+    int64_t first_ts;       // time of the block's first message, in seconds since the epoch
+    int64_t last_ts;        // time of the block's last message
+    uint32_t levels;        // bitmap of the levels present in the block, (1 << mulog_level)
+    uint32_t reserved;
+};
+typedef struct mulog_idx_entry mulog_idx_entry;
+
 /* ==================
  * Creation functions
  * ==================
  */
 
 /* Create a mulog logger that outputs to file handle f using time format tm
- * If with_debug != 0, debugging messages will be logged
- * otherwise, calls to mulog_debug will be silently ignored
+ * If with_debug != 0, messages of all levels will be logged
+ * otherwise, messages below mulog_l_info will be silently ignored (see mulog_set_level)
  * Useful to allow a program to decide its verbosity level at runtime
  */
 mulog_status mulog_create_file(mulog_ref *l, FILE *f, mulog_timefmt timefmt, int with_debug);
@@ -87,6 +202,9 @@ mulog_status mulog_create_file(mulog_ref *l, FILE *f, mulog_timefmt timefmt, int
 /* Create a mulog logger that outputs to the console with time format tm
  * with_debug has the same effect as above
  * with_color controls whether or not color output is used on Unix and Win32 consoles
+ * On Unix, color is only output to streams that are terminals, and stdout output (levels
+ * below mulog_l_warning) to a stream that is not is fully buffered (see mulog_flush);
+ * warnings and above go to stderr, which is written after every message
  */
 mulog_status mulog_create_con(mulog_ref *l, mulog_timefmt timefmt, int with_debug, int with_color);
 
@@ -97,6 +215,26 @@ mulog_status mulog_create_con(mulog_ref *l, mulog_timefmt timefmt, int with_debu
  */
 mulog_status mulog_create_split(mulog_ref *l, mulog_ref left, mulog_ref right);
 
+/* Create a mulog logger that appends to the shared-memory ring called name (as for shm_open),
+ * which must already have been created by a running mulog_collectd
+ * Any number of threads and processes may log to the same ring without locking; the
+ * collector writes their lines out whole, in the order they were claimed. Messages longer
+ * than the ring's slot size are truncated, and messages logged while the ring is full are
+ * dropped (and counted in the ring header). Unix only.
+ */
+mulog_status mulog_create_shm(mulog_ref *l, const char *name, mulog_timefmt timefmt, int with_debug);
+
+/* Create a mulog logger that writes its messages to file handle f (opened in binary mode, and
+ * empty or holding only segments) as columnar segments of seg_records records each, at most
+ * MULOG_COL_MAX (65535); see mulog_col.h for the format, and mulog_colscan for a tool that reads it
+ * Records are buffered until a segment is full, or the logger is flushed or destroyed; each
+ * flush ends the current segment. The buffers are allocated here, outside the arena, with room
+ * for 64 bytes of message per record (4 KiB at least): a record that doesn't fit ends the
+ * current segment early, and longer messages are truncated. Record times are kept in
+ * microseconds, and the time format doesn't apply. with_debug has the same effect as above.
+ */
+mulog_status mulog_create_col(mulog_ref *l, FILE *f, size_t seg_records, int with_debug);
+
 /* Creates a dummy mulog object that discards all messages */
 mulog_status mulog_create_dummy(mulog_ref *l);
 
@@ -109,28 +247,98 @@ mulog_status mulog_create_dummy(mulog_ref *l);
 mulog_status mulog_append(mulog_ref l, const char * str, size_t len);
 
 /* The signature of each of the following is similar to fprintf or vfprintf, but with the FILE handle replaced by a mulog_ref */
+/* Outputs a message of the given level to the given logger, if the level is at or above the
+ * logger's threshold (for a split logger, its own threshold and then each sink logger's)
+ * A message below the threshold is discarded before any formatting.
+ */
+void mulog_vlog(mulog_ref l, mulog_level lvl, const char * str, va_list va);
+void mulog_log(mulog_ref l, mulog_level lvl, const char * str, ...);
+
+/* The va_list functions are also macros that call mulog_vlog() directly; (mulog_verr)(...) or a
+ * pointer to one calls the function, which does the same
+ */
+
 /* Outputs an error message to the given logger */
 void mulog_verr(mulog_ref l, const char * str, va_list va);
+#define mulog_verr(l, str, va) mulog_vlog((l), mulog_l_error, (str), (va))
 void mulog_err(mulog_ref l, const char * str, ...);
 
 /* Outputs a warning message to the given logger */
 void mulog_vwarn(mulog_ref l, const char * str, va_list va);
+#define mulog_vwarn(l, str, va) mulog_vlog((l), mulog_l_warning, (str), (va))
 void mulog_warn(mulog_ref l, const char * str, ...);
 
 /* Outputs an informational message to the given logger */
 void mulog_vinfo(mulog_ref l, const char * str, va_list va);
+#define mulog_vinfo(l, str, va) mulog_vlog((l), mulog_l_info, (str), (va))
 void mulog_info(mulog_ref l, const char * str, ...);
 
-/* Outputs a debugging/verbose informational message to the given logger
- * if and only if the logger's with_debug flag is set
- * (in the case of a spliting logger, it depends of the with_debug flag of the sink loggers)
+/* Outputs a debugging message to the given logger
+ * if and only if the logger's threshold is mulog_l_debug or below (e.g. its with_debug flag is set)
  */
 void mulog_vdbg(mulog_ref l, const char* str, va_list va);
+#define mulog_vdbg(l, str, va) mulog_vlog((l), mulog_l_debug, (str), (va))
 void mulog_dbg(mulog_ref l, const char* str, ...);
 
+/* Outputs the preformatted len-byte message msg at the given level, with the same header
+ * ("[time] LEVEL: " and the thread's context) and filtering as the functions above
+ */
+void mulog_log_msg(mulog_ref l, mulog_level lvl, const char *msg, size_t len);
+
+/* Outputs the len UTF-16 or UTF-32 code units at msg like mulog_log_msg(), converted to UTF-8
+ * directly into the record the logger formats (unpaired surrogates and invalid code points
+ * become U+FFFD)
+ */
+void mulog_log_utf16(mulog_ref l, mulog_level lvl, const uint16_t *msg, size_t len);
+void mulog_log_utf32(mulog_ref l, mulog_level lvl, const uint32_t *msg, size_t len);
+
+/* Encodings of the messages given to mulog_log_from() */
+enum mulog_enc {
+	mulog_enc_utf8,
+	mulog_enc_utf16,
+	mulog_enc_utf32
+};
+typedef enum mulog_enc mulog_enc;
+
+/* The address the calling function returns to, or NULL where the compiler can't tell */
+#if defined(__GNUC__)
+#define MULOG_CALLER __builtin_return_address(0)
+#else
+#define MULOG_CALLER NULL
+#endif
+
+/* Outputs len code units of msg in the encoding enc, like mulog_log_msg(), mulog_log_utf16()
+ * or mulog_log_utf32(), for logging wrappers in other languages: a backtrace captured for the
+ * message starts at the frame that from (the wrapper's MULOG_CALLER) returns to, leaving out
+ * the wrapper's own frames. Messages logged with the functions above start theirs at their
+ * caller's frame.
+ * key, if not NULL, identifies the call site, like a format string does for mulog_log(); it
+ * is the message's category in a column logger, and must stay valid and unchanged (e.g. the
+ * format string the message was built from).
+ */
+void mulog_log_from(mulog_ref l, mulog_level lvl, const void *from, const char *key, mulog_enc enc, const void *msg, size_t len);
+
+/* Converts the len UTF-16 or UTF-32 code units at src to at most cap bytes of UTF-8 at dst,
+ * stopping at the last whole character that fits; returns the number of bytes written
+ * Unpaired surrogates and invalid code points become U+FFFD.
+ */
+size_t mulog_utf16_to_utf8(const uint16_t *src, size_t len, char *dst, size_t cap);
+size_t mulog_utf32_to_utf8(const uint32_t *src, size_t len, char *dst, size_t cap);
+
+/* Writes out any output buffered by the logger (for split loggers, by both sink loggers)
+ * Console output to a pipe or file is buffered until the buffer fills or the other console
+ * stream is written to; it is also flushed at exit
+ */
+mulog_status mulog_flush(mulog_ref l);
+
 /* =======================================
  * Logger query and modification functions
  * =======================================
+ * Loggers may be queried and reconfigured while other threads are logging to them: messages
+ * read the configuration without locking, and a set_ function returns only once every message
+ * that may still see the old configuration has finished. After it returns, the replaced file
+ * handle or sink logger is no longer in use and may be closed or destroyed.
+ * The set_ functions return mulog_err_nomem if a new configuration can't be allocated.
  */
 
 /* Returns the type of the logger */
@@ -141,11 +349,27 @@ FILE *mulog_get_file(mulog_ref l);
 /* Replaces the file handle used by a file logger */
 mulog_status mulog_set_file(mulog_ref l, FILE *f);
 
-/* Returns the value of the with_debug flag (0 -- off, 1 -- on) of a file or con logger,
- * or -1 for a dummy or split logger
+/* Returns the index file handle of a file logger, or NULL if it has none */
+FILE *mulog_get_index(mulog_ref l);
+/* Attaches an index file to a file logger (or detaches it, if idx is NULL)
+ * Every every_kb kilobytes of output, and whenever the logger is flushed, an entry describing
+ * the block just written is appended to idx (see the index file format below). The log file
+ * must be seekable. The index is detached when the log file is replaced with mulog_set_file.
+ */
+mulog_status mulog_set_index(mulog_ref l, FILE *idx, size_t every_kb);
+
+/* Returns the level threshold of a logger (messages below it are discarded), or -1 for a dummy logger */
+int mulog_get_level(mulog_ref l);
+/* Sets the level threshold of a logger; this takes effect immediately, without a grace period */
+mulog_status mulog_set_level(mulog_ref l, mulog_level lvl);
+
+/* Returns the value of the with_debug flag (0 -- off, 1 -- on) of a file, con or shm logger,
+ * i.e. whether its threshold is mulog_l_debug or below, or -1 for a dummy or split logger
  */
 int mulog_get_with_debug(mulog_ref l);
-/* Sets the with_debug flag of a file or con logger */
+/* Sets the with_debug flag of a file, con or shm logger: sets its threshold to mulog_l_vdebug
+ * if with_debug != 0, otherwise to mulog_l_info
+ */
 mulog_status mulog_set_with_debug(mulog_ref l, int with_debug);
 
 /* Returns the value of the with_color flag (0 -- off, 1 -- on) of a con logger,
@@ -172,7 +396,10 @@ mulog_status mulog_set_right(mulog_ref l, mulog_ref right);
  * ====================
  */
 
-/* Destroys a logger object */
+/* Destroys a logger object
+ * Messages already being logged to it on other threads are finished first; logging to it once
+ * mulog_destroy has been called is still an error.
+ */
 void mulog_destroy(mulog_ref l);
 
 #ifdef __cplusplus
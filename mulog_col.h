@@ -0,0 +1,228 @@
+/* Copyright 2011 Kyle Dassoff. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of
+ * conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list
+ * of conditions and the following disclaimer in the documentation and/or other materials
+ * provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY KYLE DASSOFF ''AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Layout of the columnar segment files written by column loggers (see mulog_create_col),
+ * and helpers for scanning them
+ *
+ * A file is a sequence of segments, each holding up to a few thousand records stored column
+ * by column, in native byte order:
+ *   header       a mulog_col_header
+ *   timestamps   count int64 values, in microseconds since the epoch, delta-encoded: the first
+ *                value is absolute and each other one is the difference from the previous record
+ *   levels       count bytes, each a mulog_level
+ *   categories   count uint16 ids into the segment's dictionary; a record's category is the
+ *                format string it was logged with, or for a preformatted message the call-site
+ *                key given to mulog_log_from() (the MULOG_FMT string of a C++ format() call),
+ *                so each call site gets its own category
+ *   payloads     count + 1 uint32 offsets, then the bytes they index: each record's formatted
+ *                message, without a terminator
+ *   contexts     count + 1 uint32 offsets, then the bytes they index: the thread context each
+ *                record was logged with ("key=value value2"), empty for none
+ *   dictionary   dict_count + 1 uint32 offsets, then the NUL-terminated format strings
+ *   footer       a mulog_col_footer, with the columns' offsets and the segment's statistics
+ * Every column starts on an 8-byte boundary, and a segment's length is a multiple of 8. A
+ * reader walks the segments by their headers, checks each footer's statistics to skip the
+ * segments that can't match, and reads only the columns it needs from the others.
+ */
+
+#ifndef _MULOG_COL_H_
+#define _MULOG_COL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define MULOG_COL_MAGIC 0x53434C4Du     // "MLCS"
+#define MULOG_COL_VERSION 2
+#define MULOG_COL_MAX 65535             // most records in one segment
+
+struct mulog_col_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t seg_len;                   // length of the segment, from its header to the end of its footer
+};
+typedef struct mulog_col_header mulog_col_header;
+
+struct mulog_col_footer {
+    uint64_t ts_off;                    // offsets of the columns from the start of the segment
+    uint64_t lvl_off;
+    uint64_t cat_off;
+    uint64_t pay_off;
+    uint64_t pay_len;                   // length of the payload column, offsets included
+    uint64_t ctx_off;
+    uint64_t ctx_len;                   // length of the context column, offsets included
+    uint64_t dict_off;
+    uint64_t dict_len;                  // length of the dictionary, offsets included
+    int64_t ts_min;                     // earliest and latest record times, in microseconds
+    int64_t ts_max;
+    uint32_t count;                     // number of records
+    uint32_t dict_count;                // number of dictionary entries
+    uint32_t levels;                    // bitmap of the levels present, (1 << mulog_level)
+    uint8_t level_min;
+    uint8_t level_max;
+    uint16_t reserved;
+    uint32_t version;
+    uint32_t magic;
+};
+typedef struct mulog_col_footer mulog_col_footer;
+
+// whether the len bytes at offset off of a segment start on an 8-byte boundary and end by end
+static inline int mulog_col_fits(uint64_t off, uint64_t len, uint64_t end) {
+    return off % 8 == 0 && off <= end && len <= end - off;
+}
+
+// whether an offset array of count + 1 entries, followed by the bytes it indexes, fills exactly
+// len bytes with non-decreasing offsets; with strings set, every entry must end with a NUL
+static inline int mulog_col_offsets(const char *col, uint64_t count, uint64_t len, int strings) {
+    const uint32_t *off = (const uint32_t *)col;
+    uint64_t i;
+    if(len < (count + 1) * sizeof(uint32_t) || off[0] || off[count] != len - (count + 1) * sizeof(uint32_t)) return 0;
+    for(i = 0; i < count; i++) {
+        if(off[i + 1] < off[i]) return 0;
+        if(strings && (off[i + 1] == off[i] || ((const char *)(off + count + 1))[off[i + 1] - 1])) return 0;
+    }
+    return 1;
+}
+
+/* Returns the segment starting at offset *pos of the size-byte file at base, and moves *pos
+ * to the next one; returns NULL at the end of the file, or at a segment that is damaged or was
+ * cut short (e.g. by a crash while it was being written)
+ * Besides the header and footer, this checks that every column lies within the segment, and
+ * reads the payload, context and dictionary offsets to check them, so that the accessors below stay in
+ * bounds. Category ids are checked by mulog_col_category(), and each byte of the level column
+ * should be checked against the levels of the footer before being used as an index.
+ */
+static inline const char *mulog_col_next(const char *base, size_t size, size_t *pos) {
+    const char *seg = base + *pos;
+    const mulog_col_header *h = (const mulog_col_header *)seg;
+    const mulog_col_footer *f;
+    uint64_t end, n;
+    if(size - *pos < sizeof(*h) + sizeof(*f) || h->magic != MULOG_COL_MAGIC || h->version != MULOG_COL_VERSION
+       || h->seg_len < sizeof(*h) + sizeof(*f) || h->seg_len > size - *pos || h->seg_len % 8) return NULL;
+    end = h->seg_len - sizeof(*f);
+    f = (const mulog_col_footer *)(seg + end);
+    n = f->count;
+    if(f->magic != MULOG_COL_MAGIC || f->version != MULOG_COL_VERSION || n > MULOG_COL_MAX || f->dict_count > MULOG_COL_MAX
+       || f->levels > 0xFF || f->level_max > 7 || f->level_min > f->level_max
+       || !mulog_col_fits(f->ts_off, n * sizeof(int64_t), end) || !mulog_col_fits(f->lvl_off, n, end)
+       || !mulog_col_fits(f->cat_off, n * sizeof(uint16_t), end) || !mulog_col_fits(f->pay_off, f->pay_len, end)
+       || !mulog_col_fits(f->ctx_off, f->ctx_len, end) || !mulog_col_fits(f->dict_off, f->dict_len, end)
+       || !mulog_col_offsets(seg + f->pay_off, n, f->pay_len, 0)
+       || !mulog_col_offsets(seg + f->ctx_off, n, f->ctx_len, 0)
+       || !mulog_col_offsets(seg + f->dict_off, f->dict_count, f->dict_len, 1)) return NULL;
+    *pos += h->seg_len;
+    return seg;
+}
+
+static inline const mulog_col_footer *mulog_col_footer_of(const char *seg) {
+    return (const mulog_col_footer *)(seg + ((const mulog_col_header *)seg)->seg_len - sizeof(mulog_col_footer));
+}
+
+static inline const uint8_t *mulog_col_levels(const char *seg) {
+    return (const uint8_t *)(seg + mulog_col_footer_of(seg)->lvl_off);
+}
+
+static inline const uint16_t *mulog_col_cats(const char *seg) {
+    return (const uint16_t *)(seg + mulog_col_footer_of(seg)->cat_off);
+}
+
+/* Decodes the segment's timestamps into ts, which must have room for its count records */
+static inline void mulog_col_times(const char *seg, int64_t *ts) {
+    const mulog_col_footer *f = mulog_col_footer_of(seg);
+    const int64_t *d = (const int64_t *)(seg + f->ts_off);
+    uint64_t t = 0;
+    uint32_t i;
+    // unsigned, so that a damaged delta wraps around instead of overflowing
+    for(i = 0; i < f->count; i++) ts[i] = (int64_t)(t += (uint64_t)d[i]);
+}
+
+/* Returns record i's payload, and stores its length in *len */
+static inline const char *mulog_col_payload(const char *seg, uint32_t i, size_t *len) {
+    const mulog_col_footer *f = mulog_col_footer_of(seg);
+    const uint32_t *off = (const uint32_t *)(seg + f->pay_off);
+    *len = off[i + 1] - off[i];
+    return (const char *)(off + f->count + 1) + off[i];
+}
+
+/* Returns the context record i was logged with, and stores its length (0 for none) in *len */
+static inline const char *mulog_col_context(const char *seg, uint32_t i, size_t *len) {
+    const mulog_col_footer *f = mulog_col_footer_of(seg);
+    const uint32_t *off = (const uint32_t *)(seg + f->ctx_off);
+    *len = off[i + 1] - off[i];
+    return (const char *)(off + f->count + 1) + off[i];
+}
+
+/* Returns the format string of category id, or NULL if the segment has no such category */
+static inline const char *mulog_col_category(const char *seg, uint16_t id) {
+    const mulog_col_footer *f = mulog_col_footer_of(seg);
+    const uint32_t *off = (const uint32_t *)(seg + f->dict_off);
+    if(id >= f->dict_count) return NULL;
+    return (const char *)(off + f->dict_count + 1) + off[id];
+}
+
+/* Scan kernels
+ * Selections are byte vectors holding 1 for each selected record and 0 otherwise. The loops
+ * are kept branch-free over whole columns so that the compiler vectorizes them (with -O3; the
+ * time filter needs 64-bit vector compares, e.g. -msse4.2 on x86-64).
+ */
+
+/* Selects the records whose level is in the bitmap levels */
+static inline void mulog_col_select(const uint8_t *lvl, size_t n, uint32_t levels, uint8_t *sel) {
+    unsigned lo = 0, hi, l;
+    size_t i;
+    memset(sel, 0, n);
+    if(!levels) return;
+    while(!(levels >> lo & 1)) lo++;
+    for(hi = lo; levels >> (hi + 1) & 1; hi++);
+    if(!(levels >> (hi + 1))) {
+        // one range of levels: a single compare per record
+        for(i = 0; i < n; i++) sel[i] = (uint8_t)(lvl[i] - lo) <= hi - lo;
+        return;
+    }
+    for(l = lo; levels >> l; l++) {
+        if(!(levels >> l & 1)) continue;
+        for(i = 0; i < n; i++) sel[i] |= lvl[i] == l;
+    }
+}
+
+/* Deselects the records logged before from or after to */
+static inline void mulog_col_select_time(const int64_t *ts, size_t n, int64_t from, int64_t to, uint8_t *sel) {
+    size_t i;
+    for(i = 0; i < n; i++) sel[i] &= (ts[i] >= from) & (ts[i] <= to);
+}
+
+/* Returns the number of selected records */
+static inline size_t mulog_col_count(const uint8_t *sel, size_t n) {
+    size_t i, c = 0;
+    for(i = 0; i < n; i++) c += sel[i];
+    return c;
+}
+
+/* Returns the number of selected records of the given level */
+static inline size_t mulog_col_count_level(const uint8_t *lvl, const uint8_t *sel, size_t n, unsigned level) {
+    size_t i, c = 0;
+    for(i = 0; i < n; i++) c += sel[i] & (lvl[i] == level);
+    return c;
+}
+
+#endif // header guard
@@ -0,0 +1,263 @@
+/* Copyright 2011 Kyle Dassoff. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of
+ * conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list
+ * of conditions and the following disclaimer in the documentation and/or other materials
+ * provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY KYLE DASSOFF ''AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* mulog_collectd -- creates a shared-memory log ring (see mulog_shm.h) and drains it, in
+ * order, to one or more output files
+ *
+ * Processes log to the ring with loggers made by mulog_create_shm(). The collector is the
+ * ring's only reader and the outputs' only writer, so lines are never interleaved. If the
+ * ring already exists (e.g. the collector was restarted) it carries on from where the
+ * previous collector stopped.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "mulog_shm.h"
+
+#include <time.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define MC_MAXOUT 8
+
+// how long a claimed slot stays unpublished before its producer is checked, in ms
+#define MC_DEAD_MS 10
+// how long a claimed slot stays without an owner before it is taken back, in ms
+#define MC_UNOWNED_MS 1000
+
+static volatile sig_atomic_t mc_stop = 0;
+
+static void mc_signal(int sig) {
+    (void)sig;
+    mc_stop = 1;
+}
+
+static long long mc_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void mc_sleep_us(long us) {
+    struct timespec ts = { 0, us * 1000 };
+    nanosleep(&ts, NULL);
+}
+
+/* Whether the stuck slot for position pos can be taken back from its producer
+ * A slot nobody owns yet is taken over after a timeout, after which its producer can't own
+ * it. An owned one is taken only from a producer known to have exited: a live one (even if
+ * stopped or starved) writes into the slot when it resumes, whoever has claimed it since.
+ */
+static int mc_recoverable(mulog_shm_slot *slot, uint64_t pos, long long stuck_ms) {
+    uint64_t own = __atomic_load_n(&slot->owner, __ATOMIC_ACQUIRE);
+    pid_t pid = (pid_t)MULOG_SHM_OWNER_PID(own);
+
+    if(own == MULOG_SHM_OWNER(pos, 0))
+        return stuck_ms >= MC_UNOWNED_MS && __atomic_compare_exchange_n(&slot->owner, &own,
+               MULOG_SHM_OWNER(pos, MULOG_SHM_RECLAIMED), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+    return pid > 0 && stuck_ms >= MC_DEAD_MS && kill(pid, 0) < 0 && errno == ESRCH;
+}
+
+static mulog_shm_ring *mc_open(const char *name, uint32_t slots, uint32_t size, size_t *len) {
+    mulog_shm_ring *r;
+    struct stat st;
+    uint64_t i;
+    int created = 1;
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+
+    if(fd < 0 && errno == EEXIST) {
+        created = 0;
+        fd = shm_open(name, O_RDWR, 0);
+    }
+    if(fd < 0) {
+        perror(name);
+        return NULL;
+    }
+    if(created && ftruncate(fd, (off_t)mulog_shm_size(slots, size)) < 0) {
+        perror("ftruncate");
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+    if(fstat(fd, &st) < 0) {
+        perror("fstat");
+        close(fd);
+        return NULL;
+    }
+    *len = (size_t)st.st_size;
+    r = mmap(NULL, *len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(r == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+
+    if(created) {
+        r->slot_count = slots;
+        r->slot_size = size;
+        for(i = 0; i < slots; i++) {
+            mulog_shm_slot_at(r, i)->seq = i;
+            mulog_shm_slot_at(r, i)->owner = MULOG_SHM_OWNER(i, 0);
+        }
+        r->version = MULOG_SHM_VERSION;
+        // producers check the magic, so it is set last
+        __atomic_store_n(&r->magic, MULOG_SHM_MAGIC, __ATOMIC_RELEASE);
+    } else if(r->magic != MULOG_SHM_MAGIC || r->version != MULOG_SHM_VERSION
+              || *len < mulog_shm_size(r->slot_count, r->slot_size)) {
+        fprintf(stderr, "%s: not a mulog ring\n", name);
+        munmap(r, *len);
+        return NULL;
+    }
+    return r;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [-s slots] [-z slot_size] [-o file]... [-u] name\n"
+            "  -s  number of slots (rounded up to a power of two), default 4096\n"
+            "  -z  maximum line length in bytes, default 512\n"
+            "  -o  output file to append to, or - for stdout (the default); may be repeated\n"
+            "  -u  remove the ring on exit\n", argv0);
+}
+
+int main(int argc, char **argv) {
+    FILE *out[MC_MAXOUT];
+    int nout = 0, unlink_ring = 0, dirty = 0, opt, i;
+    unsigned long slots = 4096, size = 512;
+    unsigned long long drained = 0, recovered = 0;
+    long long stuck_since = 0;
+    uint64_t stop_at = UINT64_MAX;
+    struct sigaction sa;
+    mulog_shm_ring *r;
+    const char *name;
+    uint32_t count;
+    size_t len;
+
+    while((opt = getopt(argc, argv, "s:z:o:uh")) != -1) {
+        switch(opt) {
+        case 's': slots = strtoul(optarg, NULL, 10); break;
+        case 'z': size = strtoul(optarg, NULL, 10); break;
+        case 'o':
+            if(nout == MC_MAXOUT) {
+                fprintf(stderr, "at most %d outputs\n", MC_MAXOUT);
+                return 2;
+            }
+            if(!strcmp(optarg, "-")) out[nout++] = stdout;
+            else if(!(out[nout++] = fopen(optarg, "a"))) {
+                perror(optarg);
+                return 1;
+            }
+            break;
+        case 'u': unlink_ring = 1; break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if(optind != argc - 1 || slots < 1 || slots > (1ul << 24) || size < 16 || size > (1ul << 20)) {
+        usage(argv[0]);
+        return 2;
+    }
+    name = argv[optind];
+    if(!nout) out[nout++] = stdout;
+    for(count = 1; count < slots; count <<= 1);
+
+    if(!(r = mc_open(name, count, (uint32_t)size, &len))) return 1;
+    count = r->slot_count;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = mc_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    for(;;) {
+        uint64_t t = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+        mulog_shm_slot *slot = mulog_shm_slot_at(r, t);
+        uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+        // on a signal, finish what was claimed by then, even if producers carry on
+        if(mc_stop && stop_at == UINT64_MAX) stop_at = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        if(t >= stop_at) break;
+
+        if(seq == t + 1) {
+            uint32_t n = slot->len <= r->slot_size ? slot->len : r->slot_size;
+            for(i = 0; i < nout; i++) fwrite(mulog_shm_data(slot), 1, n, out[i]);
+            dirty = 1;
+            drained++;
+            stuck_since = 0;
+            __atomic_store_n(&slot->owner, MULOG_SHM_OWNER(t + count, 0), __ATOMIC_RELAXED);
+            __atomic_store_n(&slot->seq, t + count, __ATOMIC_RELEASE);
+            __atomic_store_n(&r->tail, t + 1, __ATOMIC_RELEASE);
+            continue;
+        }
+
+        if(__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == t) {
+            // empty: a good time to write out what has been collected
+            if(dirty) {
+                for(i = 0; i < nout; i++) fflush(out[i]);
+                dirty = 0;
+            }
+            mc_sleep_us(1000);
+            continue;
+        }
+
+        // the slot at the tail is claimed but not yet published
+        long long now = mc_now_ms();
+        if(!stuck_since) stuck_since = now;
+        else if(mc_recoverable(slot, t, now - stuck_since)) {
+            uint64_t expect = t;
+            if(__atomic_compare_exchange_n(&slot->seq, &expect, t + count, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                __atomic_store_n(&slot->owner, MULOG_SHM_OWNER(t + count, 0), __ATOMIC_RELAXED);
+                __atomic_store_n(&r->tail, t + 1, __ATOMIC_RELEASE);
+                recovered++;
+            }
+            stuck_since = 0;
+            continue;
+        } else if(mc_stop && now - stuck_since >= MC_DEAD_MS * 10) {
+            // leave the slot (and what follows it) to the next collector
+            fprintf(stderr, "mulog_collectd: stopping at position %llu, still claimed by %s\n", (unsigned long long)t,
+                    MULOG_SHM_OWNER_PID(__atomic_load_n(&slot->owner, __ATOMIC_RELAXED)) ? "a running producer"
+                    : "a producer that hasn't taken ownership");
+            break;
+        }
+        mc_sleep_us(50);
+    }
+
+    for(i = 0; i < nout; i++) {
+        fflush(out[i]);
+        if(out[i] != stdout) fclose(out[i]);
+    }
+    fprintf(stderr, "mulog_collectd: %llu lines written, %llu slots recovered, %llu lines dropped\n",
+            drained, recovered, (unsigned long long)__atomic_load_n(&r->dropped, __ATOMIC_RELAXED));
+    munmap(r, len);
+    if(unlink_ring) shm_unlink(name);
+    return 0;
+}
@@ -0,0 +1,409 @@
+/* Copyright 2011 Kyle Dassoff. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of
+ * conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list
+ * of conditions and the following disclaimer in the documentation and/or other materials
+ * provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY KYLE DASSOFF ''AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* mulog_colscan -- counts, or prints, the records of a columnar log (see mulog_create_col) that
+ * match a time range and a set of levels, optionally grouped by time bucket, level and/or
+ * category (the format string a record was logged with)
+ *
+ * The file is mmap'ed and only the columns a query needs are touched: segments whose footer
+ * statistics can't match are skipped, the timestamps are decoded only when the time range cuts
+ * through a segment or records are grouped by time, and payloads and contexts are read only to
+ * print them.
+ * Filtering and counting run as branch-free loops over whole columns (see mulog_col.h).
+ */
+
+#define _GNU_SOURCE
+
+#include "mulog.h"
+#include "mulog_col.h"
+
+#include <time.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MC_ALL_LEVELS ((1u << (mulog_l_catastrophic + 1)) - 1)
+
+// group keys (-g)
+#define MC_G_TIME 1
+#define MC_G_LEVEL 2
+#define MC_G_CAT 4
+
+static const char *mc_lvnames[] = { "VDEBUG", "DEBUG", "VINFO", "INFO", "WARNING", "ERROR", "CRITICAL", "CATASTROPHIC" };
+static const char *mc_lvargs[] = { "vdebug", "debug", "vinfo", "info", "warning", "error", "critical", "catastrophic" };
+
+struct mc_group {
+    int64_t bucket;         // start of the time bucket, in microseconds
+    uint32_t cat;           // index into mc_cats
+    uint32_t level;
+    uint64_t count;
+};
+
+// groups, open-addressed by key; used slots have count != 0
+static struct mc_group *mc_groups = NULL;
+static size_t mc_ngroups = 0, mc_gmask = 0;
+
+// category names across segments, open-addressed by name
+static const char **mc_cats = NULL;
+static uint32_t *mc_catslot = NULL;
+static size_t mc_ncats = 0, mc_cmask = 0;
+
+static uint64_t mc_hash(const void *p, size_t len, uint64_t h) {
+    const unsigned char *c = p;
+    while(len--) h = (h ^ *c++) * 1099511628211u;
+    return h;
+}
+
+static void *mc_alloc(size_t n) {
+    void *p = calloc(1, n);
+    if(!p) {
+        perror("calloc");
+        exit(1);
+    }
+    return p;
+}
+
+// returns the global index of category name, which stays mapped for the whole run
+static uint32_t cat_id(const char *name) {
+    size_t h, i;
+    if(2 * (mc_ncats + 1) > mc_cmask + 1) {
+        size_t cap = mc_cmask ? 2 * (mc_cmask + 1) : 256;
+        uint32_t *slot = mc_alloc(cap * sizeof(uint32_t));
+        const char **cats = realloc(mc_cats, cap / 2 * sizeof(const char *));
+        if(!cats) {
+            perror("realloc");
+            exit(1);
+        }
+        for(i = 0; i < mc_ncats; i++) {
+            for(h = mc_hash(cats[i], strlen(cats[i]), 14695981039346656037u) & (cap - 1); slot[h]; h = (h + 1) & (cap - 1));
+            slot[h] = (uint32_t)i + 1;
+        }
+        free(mc_catslot);
+        mc_cats = cats;
+        mc_catslot = slot;
+        mc_cmask = cap - 1;
+    }
+    for(h = mc_hash(name, strlen(name), 14695981039346656037u) & mc_cmask; mc_catslot[h]; h = (h + 1) & mc_cmask) {
+        if(!strcmp(mc_cats[mc_catslot[h] - 1], name)) return mc_catslot[h] - 1;
+    }
+    mc_cats[mc_ncats] = name;
+    mc_catslot[h] = (uint32_t)++mc_ncats;
+    return (uint32_t)mc_ncats - 1;
+}
+
+static size_t group_slot(struct mc_group *g, size_t mask, int64_t bucket, uint32_t cat, uint32_t level) {
+    uint64_t h = mc_hash(&bucket, sizeof(bucket), 14695981039346656037u);
+    h = mc_hash(&cat, sizeof(cat), h);
+    h = mc_hash(&level, sizeof(level), h) & mask;
+    while(g[h].count && (g[h].bucket != bucket || g[h].cat != cat || g[h].level != level)) h = (h + 1) & mask;
+    return h;
+}
+
+// adds count records to a group; empty slots have a zero count, so an empty group isn't added
+static void group_add(int64_t bucket, uint32_t cat, uint32_t level, uint64_t count) {
+    size_t h, i;
+    if(!count) return;
+    if(2 * (mc_ngroups + 1) > mc_gmask + 1) {
+        size_t cap = mc_gmask ? 2 * (mc_gmask + 1) : 1024;
+        struct mc_group *g = mc_alloc(cap * sizeof(struct mc_group));
+        for(i = 0; i <= mc_gmask && mc_groups; i++) {
+            if(mc_groups[i].count) g[group_slot(g, cap - 1, mc_groups[i].bucket, mc_groups[i].cat, mc_groups[i].level)] = mc_groups[i];
+        }
+        free(mc_groups);
+        mc_groups = g;
+        mc_gmask = cap - 1;
+    }
+    h = group_slot(mc_groups, mc_gmask, bucket, cat, level);
+    if(!mc_groups[h].count) {
+        mc_groups[h].bucket = bucket;
+        mc_groups[h].cat = cat;
+        mc_groups[h].level = level;
+        mc_ngroups++;
+    }
+    mc_groups[h].count += count;
+}
+
+static int group_cmp(const void *a, const void *b) {
+    const struct mc_group *x = a, *y = b;
+    if(x->bucket != y->bucket) return x->bucket < y->bucket ? -1 : 1;
+    if(x->level != y->level) return x->level < y->level ? -1 : 1;
+    if(!mc_cats || x->cat == y->cat) return 0;
+    return strcmp(mc_cats[x->cat], mc_cats[y->cat]);
+}
+
+// writes the time t (in microseconds) as "YYYY-MM-DD HH:MM:SS" (UTC), with micro digits of fraction
+static void print_time(int64_t t, int micro) {
+    time_t s = (time_t)(t / 1000000);
+    struct tm tm;
+    char buf[32];
+    gmtime_r(&s, &tm);
+    strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+    if(micro) printf("%s.%06d", buf, (int)(t % 1000000));
+    else fputs(buf, stdout);
+}
+
+/* Parses "YYYY-MM-DD HH:MM[:SS]" or "YYYY-MM-DDTHH:MM[:SS]" (UTC), or seconds since the epoch;
+ * returns -1 on error
+ */
+static time_t parse_time(const char *s) {
+    struct tm tm;
+    char *end;
+    int n = 0;
+
+    memset(&tm, 0, sizeof(tm));
+    if(sscanf(s, "%d-%d-%d%*[ T]%d:%d%n:%d%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+              &tm.tm_hour, &tm.tm_min, &n, &tm.tm_sec, &n) >= 5 && !s[n]) {
+        tm.tm_year -= 1900;
+        tm.tm_mon -= 1;
+        return timegm(&tm);
+    }
+    time_t t = (time_t)strtoll(s, &end, 10);
+    return *s && !*end ? t : -1;
+}
+
+static unsigned parse_levels(char *s) {
+    unsigned levels = 0;
+    char *tok;
+    int i;
+    for(tok = strtok(s, ","); tok; tok = strtok(NULL, ",")) {
+        if(!strcasecmp(tok, "warn")) tok = "warning";
+        else if(!strcasecmp(tok, "err")) tok = "error";
+        for(i = mulog_l_vdebug; i <= mulog_l_catastrophic; i++) {
+            if(!strcasecmp(tok, mc_lvargs[i])) break;
+        }
+        if(i > mulog_l_catastrophic) return 0;
+        levels |= 1u << i;
+    }
+    return levels;
+}
+
+static int parse_groups(char *s) {
+    int groups = 0;
+    char *tok;
+    for(tok = strtok(s, ","); tok; tok = strtok(NULL, ",")) {
+        if(!strcasecmp(tok, "time")) groups |= MC_G_TIME;
+        else if(!strcasecmp(tok, "level")) groups |= MC_G_LEVEL;
+        else if(!strcasecmp(tok, "cat")) groups |= MC_G_CAT;
+        else return 0;
+    }
+    return groups;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [-f from] [-t to] [-l levels] [-g keys] [-b seconds] [-p] [-v] file\n"
+            "  from/to:  \"YYYY-MM-DD HH:MM[:SS]\" (UTC), or seconds since the epoch\n"
+            "  levels:   comma-separated list of vdebug, debug, vinfo, info, warning, error, critical,\n"
+            "            catastrophic\n"
+            "  keys:     comma-separated list of time, level and cat, to count records by time bucket\n"
+            "            (-b seconds long, 60 by default), level and/or category\n"
+            "  -p        print the matching records instead of counting them\n"
+            "  -v        report how many bytes of the file the query read\n", argv0);
+}
+
+int main(int argc, char **argv) {
+    static int64_t ts[MULOG_COL_MAX];
+    static uint8_t sel[MULOG_COL_MAX];
+    static uint32_t catmap[MULOG_COL_MAX];
+    const char *fromstr = NULL, *tostr = NULL, *log, *seg;
+    unsigned levels = MC_ALL_LEVELS;
+    int groups = 0, print = 0, verbose = 0;
+    int64_t from = INT64_MIN, to = INT64_MAX, width = 60000000;
+    uint64_t total = 0, bytes = 0;
+    size_t size, pos = 0, nseg = 0, nskip = 0, nbad = 0, i;
+    struct stat st;
+    int opt, fd;
+
+    while((opt = getopt(argc, argv, "f:t:l:g:b:pvh")) != -1) {
+        switch(opt) {
+        case 'f': fromstr = optarg; break;
+        case 't': tostr = optarg; break;
+        case 'l':
+            if(!(levels = parse_levels(optarg))) {
+                usage(argv[0]);
+                return 2;
+            }
+            break;
+        case 'g':
+            if(!(groups = parse_groups(optarg))) {
+                usage(argv[0]);
+                return 2;
+            }
+            break;
+        case 'b': width = atoll(optarg) * 1000000; break;
+        case 'p': print = 1; break;
+        case 'v': verbose = 1; break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if(optind != argc - 1 || width <= 0) {
+        usage(argv[0]);
+        return 2;
+    }
+    if(fromstr) {
+        time_t t = parse_time(fromstr);
+        if(t < 0) {
+            usage(argv[0]);
+            return 2;
+        }
+        from = (int64_t)t * 1000000;
+    }
+    if(tostr) {
+        time_t t = parse_time(tostr);
+        if(t < 0) {
+            usage(argv[0]);
+            return 2;
+        }
+        // a time to the second covers the whole second
+        to = (int64_t)t * 1000000 + 999999;
+    }
+
+    if((fd = open(argv[optind], O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+        perror(argv[optind]);
+        return 1;
+    }
+    size = (size_t)st.st_size;
+    log = size ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    if(log == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    madvise((void *)log, size, MADV_RANDOM);
+
+    while(pos < size && (seg = mulog_col_next(log, size, &pos))) {
+        const mulog_col_footer *f = mulog_col_footer_of(seg);
+        const uint8_t *lvl = mulog_col_levels(seg);
+        const uint16_t *cat = mulog_col_cats(seg);
+        size_t n = f->count;
+        int lvl_read = 0, ts_read = 0, cat_read = 0;
+
+        nseg++;
+        // mulog_col_next() has checked the payload, context and dictionary offsets
+        bytes += sizeof(mulog_col_header) + sizeof(mulog_col_footer) + 2 * (n + 1) * sizeof(uint32_t) + f->dict_len;
+        if(!n || !(f->levels & levels) || f->ts_max < from || f->ts_min > to) {
+            nskip++;
+            continue;
+        }
+
+        // the level column is only needed if the segment has levels that aren't wanted
+        if(f->levels & ~levels) {
+            mulog_col_select(lvl, n, levels, sel);
+            lvl_read = 1;
+        } else memset(sel, 1, n);
+        if(from > f->ts_min || to < f->ts_max || (groups & MC_G_TIME) || print) {
+            mulog_col_times(seg, ts);
+            ts_read = 1;
+            if(from > f->ts_min || to < f->ts_max) mulog_col_select_time(ts, n, from, to, sel);
+        }
+
+        if(print) {
+            for(i = 0; i < n; i++) {
+                const char *pay, *ctx;
+                size_t len, clen;
+                if(!sel[i]) continue;
+                if(lvl[i] > mulog_l_catastrophic) {
+                    nbad++;
+                    continue;
+                }
+                pay = mulog_col_payload(seg, (uint32_t)i, &len);
+                ctx = mulog_col_context(seg, (uint32_t)i, &clen);
+                putchar('[');
+                print_time(ts[i], 1);
+                // laid out like a text log line, with the context before the message
+                printf("] %s: %.*s%s%.*s\n", mc_lvnames[lvl[i]], (int)clen, ctx, clen ? " " : "", (int)len, pay);
+                bytes += len + clen;
+            }
+            lvl_read = 1;
+        } else if(!groups) {
+            total += mulog_col_count(sel, n);
+        } else if(groups == MC_G_LEVEL) {
+            unsigned l;
+            for(l = f->level_min; l <= f->level_max; l++) {
+                if(f->levels & levels & (1u << l)) group_add(0, 0, l, mulog_col_count_level(lvl, sel, n, l));
+            }
+            lvl_read = 1;
+        } else {
+            if(groups & MC_G_CAT) {
+                for(i = 0; i < f->dict_count; i++) catmap[i] = UINT32_MAX;
+                cat_read = 1;
+            }
+            lvl_read = 1;
+            for(i = 0; i < n; i++) {
+                int64_t bucket = 0;
+                uint32_t c = 0;
+                if(!sel[i]) continue;
+                if(lvl[i] > mulog_l_catastrophic || ((groups & MC_G_CAT) && cat[i] >= f->dict_count)) {
+                    nbad++;
+                    continue;
+                }
+                if(groups & MC_G_TIME) bucket = (int64_t)((uint64_t)ts[i] - (uint64_t)(((ts[i] % width) + width) % width));
+                if(groups & MC_G_CAT) {
+                    if(catmap[cat[i]] == UINT32_MAX) catmap[cat[i]] = cat_id(mulog_col_category(seg, cat[i]));
+                    c = catmap[cat[i]];
+                }
+                group_add(bucket, c, groups & MC_G_LEVEL ? lvl[i] : 0, 1);
+            }
+        }
+        bytes += lvl_read * n + ts_read * n * sizeof(int64_t) + cat_read * n * sizeof(uint16_t);
+    }
+    if(pos < size) fprintf(stderr, "%s: damaged or incomplete segment at offset %zu\n", argv[optind], pos);
+    if(nbad) fprintf(stderr, "%s: skipped %zu records with an invalid level or category\n", argv[optind], nbad);
+
+    if(!print && !groups) printf("%llu\n", (unsigned long long)total);
+    if(groups) {
+        struct mc_group *g = mc_alloc((mc_ngroups + 1) * sizeof(struct mc_group));
+        size_t ng = 0;
+        for(i = 0; i <= mc_gmask && mc_groups; i++) {
+            if(mc_groups[i].count) g[ng++] = mc_groups[i];
+        }
+        qsort(g, ng, sizeof(struct mc_group), group_cmp);
+        for(i = 0; i < ng; i++) {
+            if(groups & MC_G_TIME) {
+                print_time(g[i].bucket, 0);
+                putchar('\t');
+            }
+            if(groups & MC_G_LEVEL) printf("%s\t", mc_lvnames[g[i].level]);
+            printf("%llu", (unsigned long long)g[i].count);
+            if(groups & MC_G_CAT) printf("\t%s", mc_cats[g[i].cat]);
+            putchar('\n');
+        }
+        free(g);
+    }
+    if(verbose) {
+        fprintf(stderr, "%zu segments, %zu skipped; read %llu of %zu bytes\n", nseg, nskip, (unsigned long long)bytes, size);
+    }
+
+    free(mc_groups);
+    free(mc_catslot);
+    free(mc_cats);
+    if(log) munmap((void *)log, size);
+    close(fd);
+    return 0;
+}
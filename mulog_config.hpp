@@ -17,7 +17,9 @@
 #define MULOG_VERSION_STRING "2.0.0"
 
 // Feature info
+#ifndef MULOG_FEATURE_QT
 #define MULOG_FEATURE_QT 1
+#endif
 
 // Compiler info
 #define MULOG_CXX_MSVC 0
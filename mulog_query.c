@@ -0,0 +1,387 @@
+/* Copyright 2011 Kyle Dassoff. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of
+ * conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list
+ * of conditions and the following disclaimer in the documentation and/or other materials
+ * provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY KYLE DASSOFF ''AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* mulog_query -- prints the messages of a mulog log file that match a time range, a set of
+ * levels and/or a substring
+ *
+ * The log is mmap'ed; if an index file (see mulog_set_index) is available, only the blocks
+ * whose time range and level bitmap can match are scanned. The candidate bytes are split
+ * between worker threads, which find lines with memchr and substrings with memmem (both
+ * vectorized in common C libraries). Times within a block are compared exactly only for logs
+ * written with mulog_tm_fixed; with other formats the index's block granularity applies.
+ */
+
+#define _GNU_SOURCE
+
+#include "mulog.h"
+
+#include <time.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MQ_MAXTHREADS 64
+
+struct mq_range {
+    size_t begin;
+    size_t end;
+};
+
+struct mq_ranges {
+    struct mq_range *r;
+    size_t n;
+    size_t cap;
+};
+
+struct mq_query {
+    const char *log;
+    size_t size;
+    time_t from;
+    time_t to;
+    char tfrom[20];         // from and to in mulog_tm_fixed format, for comparing lines
+    char tto[20];
+    unsigned levels;        // bitmap of (1 << mulog_level)
+    const char *sub;
+    size_t sublen;
+};
+
+struct mq_worker {
+    pthread_t th;
+    const struct mq_query *q;
+    struct mq_range *work;  // candidate ranges assigned to this worker
+    size_t nwork;
+    struct mq_ranges hits;  // matching lines, in file order
+};
+
+#define MQ_ALL_LEVELS ((1u << (mulog_l_catastrophic + 1)) - 1)
+
+// line headers and -l names, indexed by mulog_level
+static const char *mq_lvnames[] = { "VDEBUG:", "DEBUG:", "VINFO:", "INFO:", "WARNING:", "ERROR:", "CRITICAL:", "CATASTROPHIC:" };
+static const char *mq_lvargs[] = { "vdebug", "debug", "vinfo", "info", "warning", "error", "critical", "catastrophic" };
+
+static int ranges_add(struct mq_ranges *rs, size_t begin, size_t end) {
+    if(rs->n && rs->r[rs->n - 1].end == begin) {
+        rs->r[rs->n - 1].end = end;
+        return 1;
+    }
+    if(rs->n == rs->cap) {
+        size_t cap = rs->cap ? rs->cap * 2 : 64;
+        struct mq_range *r = realloc(rs->r, cap * sizeof(struct mq_range));
+        if(!r) return 0;
+        rs->r = r;
+        rs->cap = cap;
+    }
+    rs->r[rs->n].begin = begin;
+    rs->r[rs->n].end = end;
+    rs->n++;
+    return 1;
+}
+
+/* Parses "YYYY-MM-DD HH:MM[:SS]" or "YYYY-MM-DDTHH:MM[:SS]" (UTC), "HH:MM[:SS]" (UTC, on the
+ * day of base), or seconds since the epoch; returns -1 on error
+ */
+static time_t parse_time(const char *s, time_t base) {
+    struct tm tm;
+    char *end;
+    int n = 0;
+
+    memset(&tm, 0, sizeof(tm));
+    if(sscanf(s, "%d-%d-%d%*[ T]%d:%d%n:%d%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+              &tm.tm_hour, &tm.tm_min, &n, &tm.tm_sec, &n) >= 5 && !s[n]) {
+        tm.tm_year -= 1900;
+        tm.tm_mon -= 1;
+        return timegm(&tm);
+    }
+    if(sscanf(s, "%d:%d%n:%d%n", &tm.tm_hour, &tm.tm_min, &n, &tm.tm_sec, &n) >= 2 && !s[n]) {
+        return base - base % 86400 + tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec;
+    }
+    time_t t = (time_t)strtoll(s, &end, 10);
+    return *s && !*end ? t : -1;
+}
+
+static unsigned parse_levels(char *s) {
+    unsigned levels = 0;
+    char *tok;
+    int i;
+    for(tok = strtok(s, ","); tok; tok = strtok(NULL, ",")) {
+        if(!strcasecmp(tok, "warn")) tok = "warning";
+        else if(!strcasecmp(tok, "err")) tok = "error";
+        for(i = mulog_l_vdebug; i <= mulog_l_catastrophic; i++) {
+            if(!strcasecmp(tok, mq_lvargs[i])) break;
+        }
+        if(i > mulog_l_catastrophic) return 0;
+        levels |= 1u << i;
+    }
+    return levels;
+}
+
+/* Converts a version 1 index entry's level bitmap, which numbered debug, info, warning and error 0-3 */
+static unsigned idx_levels_v1(unsigned v1) {
+    static const int map[] = { mulog_l_debug, mulog_l_info, mulog_l_warning, mulog_l_error };
+    unsigned levels = 0;
+    int i;
+    for(i = 0; i < 4; i++) {
+        if(v1 & (1u << i)) levels |= 1u << map[i];
+    }
+    return levels;
+}
+
+/* Checks a line ("[time] LEVEL: message", without its newline) against the level and time filters */
+static int line_match(const struct mq_query *q, const char *ln, size_t len) {
+    const char *hend;
+
+    if(len < 2 || ln[0] != '[' || !(hend = memchr(ln, ']', len))) return 0;
+
+    // "[YYYY-MM-DD HH:MM:SS]" sorts lexicographically, so compare it as text
+    if(hend - ln == 20 && ln[5] == '-' && ln[11] == ' ') {
+        if(memcmp(ln + 1, q->tfrom, 19) < 0 || memcmp(ln + 1, q->tto, 19) > 0) return 0;
+    }
+
+    if(q->levels != MQ_ALL_LEVELS) {
+        const char *lv = hend + 2;
+        size_t rest = len - (size_t)(lv - ln);
+        int i;
+        if(hend + 2 > ln + len) return 0;
+        for(i = mulog_l_vdebug; i <= mulog_l_catastrophic; i++) {
+            size_t nl = strlen(mq_lvnames[i]);
+            if(rest >= nl && !memcmp(lv, mq_lvnames[i], nl)) break;
+        }
+        if(i > mulog_l_catastrophic || !(q->levels & (1u << i))) return 0;
+    }
+    return 1;
+}
+
+static void scan_range(struct mq_worker *w, size_t begin, size_t end) {
+    const struct mq_query *q = w->q;
+    const char *log = q->log;
+    const char *p = log + begin;
+    const char *e = log + end;
+
+    while(p < e) {
+        const char *ln = p;
+        const char *nl;
+        if(q->sublen) {
+            // jump straight to the next occurrence, then widen it to its line
+            const char *hit = memmem(p, (size_t)(e - p), q->sub, q->sublen);
+            if(!hit) return;
+            ln = memrchr(p, '\n', (size_t)(hit - p));
+            ln = ln ? ln + 1 : p;
+            p = hit;
+        }
+        nl = memchr(p, '\n', (size_t)(e - p));
+        if(!nl) nl = e;
+        if(line_match(q, ln, (size_t)(nl - ln))) {
+            if(!ranges_add(&w->hits, (size_t)(ln - log), (size_t)(nl - log) + (nl < e))) return;
+        }
+        p = nl + 1;
+    }
+}
+
+static void *worker(void *arg) {
+    struct mq_worker *w = arg;
+    size_t i;
+    for(i = 0; i < w->nwork; i++) scan_range(w, w->work[i].begin, w->work[i].end);
+    return NULL;
+}
+
+/* Collects the byte ranges of the log that may hold matches, from the index if there is one */
+static int candidates(const struct mq_query *q, const char *idxpath, struct mq_ranges *out) {
+    mulog_idx_header hdr;
+    mulog_idx_entry ent;
+    size_t pos = 0;
+    FILE *f;
+
+    if(!idxpath) return ranges_add(out, 0, q->size);
+    if(!(f = fopen(idxpath, "rb"))) {
+        perror(idxpath);
+        return 0;
+    }
+    if(fread(&hdr, sizeof(hdr), 1, f) != 1 || memcmp(hdr.magic, "MLIX", 4) || hdr.version < 1 || hdr.version > MULOG_IDX_VERSION) {
+        fprintf(stderr, "%s: not a mulog index\n", idxpath);
+        fclose(f);
+        return 0;
+    }
+    while(fread(&ent, sizeof(ent), 1, f) == 1) {
+        size_t b = ent.offset, e = ent.offset + ent.length;
+        if(b >= q->size) break;
+        if(e > q->size) e = q->size;
+        if(hdr.version == 1) ent.levels = idx_levels_v1(ent.levels);
+        // bytes not covered by any entry can't be ruled out
+        if(b > pos && !ranges_add(out, pos, b)) break;
+        if((ent.levels & q->levels) && ent.last_ts >= q->from && ent.first_ts <= q->to) {
+            if(!ranges_add(out, b, e)) break;
+        }
+        if(e > pos) pos = e;
+    }
+    fclose(f);
+    if(pos < q->size) ranges_add(out, pos, q->size);
+    return 1;
+}
+
+/* Splits the candidate ranges into nthreads shares of about equal size, cut at line ends */
+static void distribute(const struct mq_query *q, struct mq_ranges *cand, struct mq_worker *w, int nthreads) {
+    size_t total = 0, share, i;
+    int t = 0;
+
+    for(i = 0; i < cand->n; i++) total += cand->r[i].end - cand->r[i].begin;
+    share = total / nthreads + 1;
+
+    struct mq_ranges *parts = calloc((size_t)nthreads, sizeof(struct mq_ranges));
+    size_t acc = 0;
+    for(i = 0; i < cand->n; i++) {
+        size_t b = cand->r[i].begin, e = cand->r[i].end;
+        while(b < e) {
+            size_t cut = e;
+            if(t < nthreads - 1 && acc + (e - b) > share) {
+                const char *nl = memchr(q->log + b + (share - acc), '\n', e - b - (share - acc));
+                cut = nl ? (size_t)(nl - q->log) + 1 : e;
+            }
+            ranges_add(&parts[t], b, cut);
+            acc += cut - b;
+            b = cut;
+            if(acc >= share && t < nthreads - 1) {
+                t++;
+                acc = 0;
+            }
+        }
+    }
+    for(t = 0; t < nthreads; t++) {
+        w[t].work = parts[t].r;
+        w[t].nwork = parts[t].n;
+    }
+    free(parts);
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [-i index] [-f from] [-t to] [-l levels] [-s substring] [-j threads] logfile\n"
+            "  from/to:  \"YYYY-MM-DD HH:MM[:SS]\" or \"HH:MM[:SS]\" (UTC), or seconds since the epoch\n"
+            "  levels:   comma-separated list of vdebug, debug, vinfo, info, warning, error, critical,\n"
+            "            catastrophic\n", argv0);
+}
+
+int main(int argc, char **argv) {
+    struct mq_query q;
+    struct mq_ranges cand = { NULL, 0, 0 };
+    struct mq_worker w[MQ_MAXTHREADS];
+    int started[MQ_MAXTHREADS];
+    const char *idxpath = NULL, *fromstr = NULL, *tostr = NULL;
+    long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    struct stat st;
+    time_t base;
+    int opt, fd, t;
+
+    memset(&q, 0, sizeof(q));
+    q.levels = MQ_ALL_LEVELS;
+    while((opt = getopt(argc, argv, "i:f:t:l:s:j:h")) != -1) {
+        switch(opt) {
+        case 'i': idxpath = optarg; break;
+        case 'f': fromstr = optarg; break;
+        case 't': tostr = optarg; break;
+        case 'l':
+            if(!(q.levels = parse_levels(optarg))) {
+                usage(argv[0]);
+                return 2;
+            }
+            break;
+        case 's':
+            q.sub = optarg;
+            q.sublen = strlen(optarg);
+            break;
+        case 'j': nthreads = atol(optarg); break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if(optind != argc - 1) {
+        usage(argv[0]);
+        return 2;
+    }
+    if(nthreads < 1) nthreads = 1;
+    if(nthreads > MQ_MAXTHREADS) nthreads = MQ_MAXTHREADS;
+
+    if((fd = open(argv[optind], O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+        perror(argv[optind]);
+        return 1;
+    }
+    q.size = (size_t)st.st_size;
+    if(!q.size) return 0;
+    q.log = mmap(NULL, q.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(q.log == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    // "HH:MM" times are taken on the day of the first indexed block, or today
+    base = time(NULL);
+    if(idxpath) {
+        FILE *f = fopen(idxpath, "rb");
+        mulog_idx_entry ent;
+        if(f && fseek(f, sizeof(mulog_idx_header), SEEK_SET) == 0 && fread(&ent, sizeof(ent), 1, f) == 1) base = (time_t)ent.first_ts;
+        if(f) fclose(f);
+    }
+    q.from = fromstr ? parse_time(fromstr, base) : 0;
+    q.to = tostr ? parse_time(tostr, base) : (time_t)INT64_MAX;
+    if(q.from < 0 || q.to < 0) {
+        usage(argv[0]);
+        return 2;
+    }
+    {
+        struct tm tm;
+        gmtime_r(&q.from, &tm);
+        strftime(q.tfrom, sizeof(q.tfrom), "%Y-%m-%d %H:%M:%S", &tm);
+        if(!tostr || !gmtime_r(&q.to, &tm)) strcpy(q.tto, "9999-99-99 99:99:99");
+        else strftime(q.tto, sizeof(q.tto), "%Y-%m-%d %H:%M:%S", &tm);
+    }
+
+    if(!candidates(&q, idxpath, &cand)) return 1;
+    memset(w, 0, sizeof(w));
+    for(t = 0; t < nthreads; t++) w[t].q = &q;
+    distribute(&q, &cand, w, (int)nthreads);
+    madvise((void *)q.log, q.size, cand.n > 1 ? MADV_RANDOM : MADV_SEQUENTIAL);
+
+    for(t = 1; t < nthreads; t++) started[t] = !pthread_create(&w[t].th, NULL, worker, &w[t]);
+    worker(&w[0]);
+    for(t = 1; t < nthreads; t++) {
+        if(started[t]) pthread_join(w[t].th, NULL);
+        else worker(&w[t]);
+    }
+
+    for(t = 0; t < nthreads; t++) {
+        size_t i;
+        for(i = 0; i < w[t].hits.n; i++) fwrite(q.log + w[t].hits.r[i].begin, 1, w[t].hits.r[i].end - w[t].hits.r[i].begin, stdout);
+        free(w[t].hits.r);
+        free(w[t].work);
+    }
+    free(cand.r);
+    munmap((void *)q.log, q.size);
+    close(fd);
+    return 0;
+}
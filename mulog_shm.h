@@ -0,0 +1,105 @@
+/* Copyright 2011 Kyle Dassoff. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are
+ * permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of
+ * conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list
+ * of conditions and the following disclaimer in the documentation and/or other materials
+ * provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY KYLE DASSOFF ''AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Layout of the shared-memory ring used by shm loggers and mulog_collectd
+ *
+ * The ring is a header followed by slot_count fixed-size slots. A producer claims position p
+ * by advancing head with a compare-and-swap (only while p - tail < slot_count, otherwise the
+ * record is dropped), takes ownership of slot p % slot_count by moving its owner from
+ * MULOG_SHM_OWNER(p, 0) to MULOG_SHM_OWNER(p, pid) with another, writes a whole formatted
+ * line into the slot, and publishes it by moving the slot's seq from p to p + 1. The
+ * collector drains positions in order: once slot seq == tail + 1 it writes the line out and
+ * frees the slot for the next lap by setting its owner to MULOG_SHM_OWNER(tail + slot_count, 0)
+ * and its seq to tail + slot_count, then advances tail.
+ *
+ * A slot that stays claimed but unpublished is recovered by the collector (by moving its seq
+ * from p to p + slot_count itself) in two cases:
+ * - its owner is still MULOG_SHM_OWNER(p, 0) after a timeout, and the collector takes it over
+ *   by moving it to MULOG_SHM_OWNER(p, MULOG_SHM_RECLAIMED). The producer (dead, or too slow)
+ *   can no longer take ownership, and a slow one drops its record.
+ * - its producer is known to have exited. A live producer (even a stopped one) writes into the
+ *   slot when it resumes, so it keeps the slot however long it takes. Whether it has exited is
+ *   checked with kill(pid, 0), which only works within one PID namespace: producers in another
+ *   one (e.g. another container) would be taken for dead, so they must share the collector's.
+ * Records a producer drops, when the ring is full or its slot was taken back, are counted in
+ * dropped. Positions in the owner word are truncated to 32 bits, so a producer stalled between
+ * its two compare-and-swaps for 2^32 positions could mistake a later lap's slot for its own.
+ */
+
+#ifndef _MULOG_SHM_H_
+#define _MULOG_SHM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MULOG_SHM_MAGIC 0x4D4C5352u     // "MLSR"
+#define MULOG_SHM_VERSION 2
+#define MULOG_SHM_LINE 64
+
+// a slot's owner word: the low 32 bits of the position it is for, and the pid of its producer
+#define MULOG_SHM_OWNER(pos, pid) ((uint64_t)(uint32_t)(pos) << 32 | (uint32_t)(pid))
+#define MULOG_SHM_OWNER_PID(own) ((int32_t)(uint32_t)(own))
+#define MULOG_SHM_RECLAIMED (-1)        // the pid of a slot the collector took back before it was owned
+
+struct mulog_shm_ring {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_count;                // a power of two
+    uint32_t slot_size;                 // bytes of line data per slot
+    uint64_t dropped;                   // records dropped because the ring was full or their slot was taken back
+    char pad0[MULOG_SHM_LINE - 24];
+    uint64_t head;                      // next position producers will claim
+    char pad1[MULOG_SHM_LINE - 8];
+    uint64_t tail;                      // next position the collector will drain
+    char pad2[MULOG_SHM_LINE - 8];
+};
+typedef struct mulog_shm_ring mulog_shm_ring;
+
+struct mulog_shm_slot {
+    uint64_t seq;                       // position the slot is free for, or that position + 1 once published
+    uint64_t owner;                     // MULOG_SHM_OWNER(position, producer pid), with pid 0 until owned
+    uint32_t len;                       // length of the line in data
+    uint32_t pad;
+    // followed by slot_size bytes of data
+};
+typedef struct mulog_shm_slot mulog_shm_slot;
+
+static inline size_t mulog_shm_stride(const mulog_shm_ring *r) {
+    return (sizeof(mulog_shm_slot) + r->slot_size + MULOG_SHM_LINE - 1) & ~(size_t)(MULOG_SHM_LINE - 1);
+}
+
+static inline size_t mulog_shm_size(uint32_t slot_count, uint32_t slot_size) {
+    mulog_shm_ring r;
+    r.slot_size = slot_size;
+    return sizeof(mulog_shm_ring) + slot_count * mulog_shm_stride(&r);
+}
+
+static inline mulog_shm_slot *mulog_shm_slot_at(mulog_shm_ring *r, uint64_t pos) {
+    return (mulog_shm_slot *)((char *)(r + 1) + (pos & (r->slot_count - 1)) * mulog_shm_stride(r));
+}
+
+static inline char *mulog_shm_data(mulog_shm_slot *s) {
+    return (char *)(s + 1);
+}
+
+#endif // header guard
@@ -0,0 +1,506 @@
+/*
+ * testcxx.cpp
+ *
+ *  Test program for the C++ interface. Returns 0 if every check passes.
+ *
+ *  The transcoders are checked on random UTF-16 and UTF-32 strings, whole and cut short at
+ *  every output size, against a plain one-character-at-a-time reference, against iconv for
+ *  valid input and, when built with Qt, against QString::toUtf8(). Qt replaces unpaired
+ *  surrogates with '?' rather than U+FFFD, so only valid strings are compared with it.
+ *
+ *  LoggerBase::format() is checked for its output, through a CLogger for the whole line a C
+ *  file logger writes, and for the categories and contexts a C column logger records.
+ *
+ *  Backtraces of errors logged through a CLogger must start in the function that logged them.
+ *
+ *  Built with MULOG_TEST_NOALLOC (testcxx_na, glibc only), it also fails if messages logged
+ *  through a CLogger, as std::string, wide string or format() calls, allocate after warm-up.
+ */
+
+#include "LoggerBase.hpp"
+#include "CLogger.hpp"
+#include "Transcode.hpp"
+#include "mulog.h"
+#include "mulog_col.h"
+
+#include <stdint.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+#include <iconv.h>
+
+#ifdef MULOG_TEST_NOALLOC
+// Counts heap allocations made while armed; operator new ends up here as well
+extern "C" {
+void * __libc_malloc(std::size_t n);
+void * __libc_calloc(std::size_t n, std::size_t sz);
+void * __libc_realloc(void * p, std::size_t n);
+}
+
+static bool na_armed = false;
+static unsigned long na_count = 0;
+
+extern "C" void * malloc(std::size_t n) noexcept {
+	if(na_armed) na_count++;
+	return __libc_malloc(n);
+}
+extern "C" void * calloc(std::size_t n, std::size_t sz) noexcept {
+	if(na_armed) na_count++;
+	return __libc_calloc(n, sz);
+}
+extern "C" void * realloc(void * p, std::size_t n) noexcept {
+	if(na_armed) na_count++;
+	return __libc_realloc(p, n);
+}
+#endif
+
+using namespace mulog;
+
+// Each logs an error through a CLogger, whose backtrace must start in the function (the flush
+// keeps the logging call from being a tail call)
+extern "C" __attribute__((noinline)) void trace_string(CLogger & log) {
+	log.err(std::string("traced std::string"));
+	mulog_flush(log.handle());
+}
+extern "C" __attribute__((noinline)) void trace_wide(CLogger & log) {
+	log.err(std::wstring(L"traced wide string"));
+	mulog_flush(log.handle());
+}
+extern "C" __attribute__((noinline)) void trace_format(CLogger & log) {
+	log.format(Severity::Error, MULOG_FMT("traced {}"), "format()");
+	mulog_flush(log.handle());
+}
+
+namespace {
+
+int failures = 0;
+
+void fail(const char * what, const std::string & got, const std::string & want) {
+	if(++failures > 10) return;
+	std::printf("FAIL %s\n  got:  ", what);
+	for(unsigned char c : got) std::printf("%02x", c);
+	std::printf("\n  want: ");
+	for(unsigned char c : want) std::printf("%02x", c);
+	std::printf("\n");
+}
+
+// xorshift64, so runs are repeatable for a given seed
+uint64_t rng_state = 88172645463325252ull;
+uint32_t rnd(uint32_t n) {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return static_cast<uint32_t>(rng_state % n);
+}
+
+// Reference encoding: one character at a time, keeping the end of each character so that
+// truncated conversions can be checked against the longest whole prefix
+struct Reference {
+	std::string out;
+	std::vector<std::size_t> ends;
+
+	void put(uint32_t cp) {
+		if(cp > 0x10FFFF || (cp >= 0xD800 && cp < 0xE000)) cp = 0xFFFD;
+		if(cp < 0x80) out += static_cast<char>(cp);
+		else if(cp < 0x800) {
+			out += static_cast<char>(0xC0 | (cp >> 6));
+			out += static_cast<char>(0x80 | (cp & 0x3F));
+		} else if(cp < 0x10000) {
+			out += static_cast<char>(0xE0 | (cp >> 12));
+			out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+			out += static_cast<char>(0x80 | (cp & 0x3F));
+		} else {
+			out += static_cast<char>(0xF0 | (cp >> 18));
+			out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+			out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+			out += static_cast<char>(0x80 | (cp & 0x3F));
+		}
+		ends.push_back(out.size());
+	}
+
+	// the output expected from a conversion into cap bytes
+	std::string prefix(std::size_t cap) const {
+		std::size_t n = 0;
+		for(std::size_t e : ends) {
+			if(e > cap) break;
+			n = e;
+		}
+		return out.substr(0, n);
+	}
+};
+
+Reference reference16(const std::vector<uint16_t> & s) {
+	Reference r;
+	for(std::size_t i = 0; i < s.size(); ++i) {
+		uint32_t u = s[i];
+		if(u >= 0xD800 && u < 0xDC00 && i + 1 < s.size() && s[i + 1] >= 0xDC00 && s[i + 1] < 0xE000) {
+			u = 0x10000 + ((u - 0xD800) << 10) + (s[++i] - 0xDC00);
+		}
+		r.put(u);
+	}
+	return r;
+}
+
+Reference reference32(const std::vector<uint32_t> & s) {
+	Reference r;
+	for(uint32_t u : s) r.put(u);
+	return r;
+}
+
+// Random strings, in runs of one kind of character so that the vectorized paths get used
+std::vector<uint16_t> random16(bool valid) {
+	std::vector<uint16_t> s;
+	const uint32_t runs = rnd(8);
+	for(uint32_t r = 0; r < runs; ++r) {
+		const uint32_t kind = rnd(valid ? 4 : 6), len = rnd(40);
+		for(uint32_t i = 0; i < len; ++i) {
+			switch(kind) {
+			case 0: s.push_back(static_cast<uint16_t>(rnd(0x80))); break;
+			case 1: s.push_back(static_cast<uint16_t>(0x80 + rnd(0x800 - 0x80))); break;
+			case 2: s.push_back(static_cast<uint16_t>(rnd(2) ? 0x800 + rnd(0xD800 - 0x800) : 0xE000 + rnd(0x2000))); break;
+			case 3:
+				s.push_back(static_cast<uint16_t>(0xD800 + rnd(0x400)));
+				s.push_back(static_cast<uint16_t>(0xDC00 + rnd(0x400)));
+				break;
+			case 4: s.push_back(static_cast<uint16_t>(0xD800 + rnd(0x400))); break;
+			default: s.push_back(static_cast<uint16_t>(0xDC00 + rnd(0x400))); break;
+			}
+		}
+	}
+	return s;
+}
+
+std::vector<uint32_t> random32(bool valid) {
+	std::vector<uint32_t> s;
+	const uint32_t runs = rnd(8);
+	for(uint32_t r = 0; r < runs; ++r) {
+		const uint32_t kind = rnd(valid ? 4 : 6), len = rnd(40);
+		for(uint32_t i = 0; i < len; ++i) {
+			switch(kind) {
+			case 0: s.push_back(rnd(0x80)); break;
+			case 1: s.push_back(0x80 + rnd(0x800 - 0x80)); break;
+			case 2: s.push_back(rnd(2) ? 0x800 + rnd(0xD800 - 0x800) : 0xE000 + rnd(0x2000)); break;
+			case 3: s.push_back(0x10000 + rnd(0x100000)); break;
+			case 4: s.push_back(0xD800 + rnd(0x800)); break;
+			default: s.push_back(0x110000 + rnd(0x7FEF0000)); break;
+			}
+		}
+	}
+	return s;
+}
+
+std::string convert16(const std::vector<uint16_t> & s, std::size_t cap) {
+	std::string out(cap + 1, '\xAA');
+	const std::size_t n = utf16_to_utf8(s.data(), s.size(), &out[0], cap);
+	if(out[cap] != '\xAA') fail("utf16_to_utf8 wrote past cap", out, std::string());
+	out.resize(n <= cap ? n : cap);
+	return out;
+}
+
+std::string convert32(const std::vector<uint32_t> & s, std::size_t cap) {
+	std::string out(cap + 1, '\xAA');
+	const std::size_t n = utf32_to_utf8(s.data(), s.size(), &out[0], cap);
+	if(out[cap] != '\xAA') fail("utf32_to_utf8 wrote past cap", out, std::string());
+	out.resize(n <= cap ? n : cap);
+	return out;
+}
+
+std::string iconv_utf8(const char * from, const void * src, std::size_t bytes) {
+	iconv_t cd = iconv_open("UTF-8", from);
+	std::string out(bytes * 2 + 16, '\0');
+	char * in = const_cast<char *>(static_cast<const char *>(src));
+	char * o = &out[0];
+	std::size_t inleft = bytes, outleft = out.size();
+	if(cd == reinterpret_cast<iconv_t>(-1)) return std::string();
+	if(iconv(cd, &in, &inleft, &o, &outleft) == static_cast<std::size_t>(-1)) out = "<iconv error>";
+	else out.resize(out.size() - outleft);
+	iconv_close(cd);
+	return out;
+}
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+const char * const iconv16 = "UTF-16BE";
+const char * const iconv32 = "UTF-32BE";
+#else
+const char * const iconv16 = "UTF-16LE";
+const char * const iconv32 = "UTF-32LE";
+#endif
+
+// Keeps the last message issued to it
+class Capture : public LoggerBase {
+public:
+	std::string last;
+	using LoggerBase::issue;
+	void issue(Severity, const char * msg, std::size_t len) override { last.assign(msg, len); }
+};
+
+// The message of the record a C file logger wrote between at and the end of f
+std::string logged(FILE * f, long at) {
+	const long end = std::ftell(f);
+	std::string rec(static_cast<std::size_t>(end - at), '\0');
+	std::fseek(f, at, SEEK_SET);
+	rec.resize(std::fread(&rec[0], 1, rec.size(), f));
+	std::fseek(f, 0, SEEK_END);
+	const std::size_t msg = rec.find("INFO: ");
+	if(msg == std::string::npos || rec.empty() || rec.back() != '\n') return "<no record>";
+	return rec.substr(msg + 6, rec.size() - msg - 7);
+}
+
+void test_transcode(int rounds) {
+	Capture cap;
+	unsigned long truncations = 0;
+	FILE * f = std::tmpfile();
+	mulog_ref l;
+	mulog_create_file(&l, f, mulog_tm_fixed, 1);
+	CLogger log(l);
+
+	for(int round = 0; round < rounds; ++round) {
+		const bool valid = rnd(2);
+		const std::vector<uint16_t> s16 = random16(valid);
+		const std::vector<uint32_t> s32 = random32(valid);
+		const Reference r16 = reference16(s16), r32 = reference32(s32);
+
+		if(convert16(s16, utf8_bound16(s16.size())) != r16.out) fail("utf16_to_utf8", convert16(s16, utf8_bound16(s16.size())), r16.out);
+		if(convert32(s32, utf8_bound32(s32.size())) != r32.out) fail("utf32_to_utf8", convert32(s32, utf8_bound32(s32.size())), r32.out);
+		for(std::size_t c = 0; c <= r16.out.size(); c += 1 + rnd(4), ++truncations) {
+			if(convert16(s16, c) != r16.prefix(c)) fail("utf16_to_utf8 (truncated)", convert16(s16, c), r16.prefix(c));
+		}
+		for(std::size_t c = 0; c <= r32.out.size(); c += 1 + rnd(4), ++truncations) {
+			if(convert32(s32, c) != r32.prefix(c)) fail("utf32_to_utf8 (truncated)", convert32(s32, c), r32.prefix(c));
+		}
+
+		if(valid) {
+			const std::string i16 = iconv_utf8(iconv16, s16.data(), s16.size() * 2);
+			const std::string i32 = iconv_utf8(iconv32, s32.data(), s32.size() * 4);
+			if(i16 != r16.out) fail("utf16 reference vs iconv", r16.out, i16);
+			if(i32 != r32.out) fail("utf32 reference vs iconv", r32.out, i32);
+#if MULOG_FEATURE_QT
+			const QString q16 = QString::fromUtf16(s16.data(), static_cast<int>(s16.size()));
+			const QByteArray u16 = q16.toUtf8();
+			const QByteArray u32 = QString::fromUcs4(s32.data(), static_cast<int>(s32.size())).toUtf8();
+			if(convert16(s16, utf8_bound16(s16.size())) != std::string(u16.constData(), u16.size())) {
+				fail("utf16_to_utf8 vs QString::toUtf8", convert16(s16, utf8_bound16(s16.size())), std::string(u16.constData(), u16.size()));
+			}
+			if(convert32(s32, utf8_bound32(s32.size())) != std::string(u32.constData(), u32.size())) {
+				fail("utf32_to_utf8 vs QString::toUtf8", convert32(s32, utf8_bound32(s32.size())), std::string(u32.constData(), u32.size()));
+			}
+			cap.issue(Severity::Info, q16);
+			if(cap.last != r16.out) fail("LoggerBase::issue(QString)", cap.last, r16.out);
+#endif
+		}
+
+		// std::wstring goes through whichever converter matches wchar_t
+		std::wstring w;
+		if(sizeof(wchar_t) == 2) for(uint16_t u : s16) w += static_cast<wchar_t>(u);
+		else for(uint32_t u : s32) w += static_cast<wchar_t>(u);
+		cap.issue(Severity::Info, w);
+		if(cap.last != (sizeof(wchar_t) == 2 ? r16.out : r32.out)) fail("LoggerBase::issue(std::wstring)", cap.last, sizeof(wchar_t) == 2 ? r16.out : r32.out);
+
+		// converted by the C logger into the record it writes
+		long at = std::ftell(f);
+		log.issue(Severity::Info, w);
+		std::string got = logged(f, at);
+		if(got != (sizeof(wchar_t) == 2 ? r16.out : r32.out)) fail("CLogger::issue(std::wstring)", got, sizeof(wchar_t) == 2 ? r16.out : r32.out);
+		at = std::ftell(f);
+		mulog_log_utf16(l, mulog_l_info, s16.data(), s16.size());
+		if((got = logged(f, at)) != r16.out) fail("mulog_log_utf16", got, r16.out);
+		at = std::ftell(f);
+		mulog_log_utf32(l, mulog_l_info, s32.data(), s32.size());
+		if((got = logged(f, at)) != r32.out) fail("mulog_log_utf32", got, r32.out);
+	}
+	mulog_destroy(l);
+	std::fclose(f);
+	std::printf("transcode: %d random strings, %lu truncated conversions%s\n", rounds, truncations,
+			MULOG_FEATURE_QT ? ", compared with Qt" : "");
+}
+
+void expect(const char * what, const std::string & got, const char * want) {
+	if(got != want) fail(what, got, want);
+}
+
+void test_format() {
+	Capture cap;
+	const char * null = nullptr;
+	char buf[] = "mutable";
+	const std::string str("std::string");
+	const int * ptr = reinterpret_cast<const int *>(static_cast<uintptr_t>(0xBEEF));
+
+	cap.format(Severity::Info, MULOG_FMT("{} {} {} {}"), std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::max(),
+			std::numeric_limits<uint64_t>::max(), std::numeric_limits<uint64_t>::min());
+	expect("format int64/uint64 limits", cap.last, "-9223372036854775808 9223372036854775807 18446744073709551615 0");
+	cap.format(Severity::Info, MULOG_FMT("{} {} {} {}"), std::numeric_limits<int32_t>::min(), std::numeric_limits<uint32_t>::max(),
+			std::numeric_limits<int16_t>::min(), std::numeric_limits<int8_t>::min());
+	expect("format int32/int16/int8 limits", cap.last, "-2147483648 4294967295 -32768 -128");
+	cap.format(Severity::Info, MULOG_FMT("{} {} {}"), static_cast<uint8_t>(255), static_cast<short>(-1), 0);
+	expect("format small integers", cap.last, "255 -1 0");
+	cap.format(Severity::Info, MULOG_FMT("{{}} {{{}}} }}{{"), 7);
+	expect("format escaped braces", cap.last, "{} {7} }{");
+	cap.format(Severity::Info, MULOG_FMT("{}/{}"), true, false);
+	expect("format bool", cap.last, "true/false");
+	cap.format(Severity::Info, MULOG_FMT("[{}] [{}] [{}] [{}]"), null, "literal", buf, 'c');
+	expect("format strings and char", cap.last, "[(null)] [literal] [mutable] [c]");
+	cap.format(Severity::Info, MULOG_FMT("{}{}"), str, std::string());
+	expect("format std::string", cap.last, "std::string");
+	cap.format(Severity::Info, MULOG_FMT("{} {}"), 0.5, 1e20);
+	expect("format floating point", cap.last, "0.5 1e+20");
+	cap.format(Severity::Info, MULOG_FMT("{} {} {} {}"), 0.1 + 0.2, -1.0f / 3, 1e-300, 123456789.0L);
+	expect("format floating point as %g", cap.last, "0.3 -0.333333 1e-300 1.23457e+08");
+	cap.format(Severity::Info, MULOG_FMT("{}"), ptr);
+	expect("format pointer", cap.last, sizeof(void *) == 8 ? "0x000000000000beef" : "0x0000beef");
+	cap.format(Severity::Info, MULOG_FMT("no arguments"));
+	expect("format literal only", cap.last, "no arguments");
+	cap.last = "unchanged";
+	cap.set_severity(Severity::Warning);
+	cap.format(Severity::Info, MULOG_FMT("{}"), 1);
+	expect("format below the filter", cap.last, "unchanged");
+
+	// through a C file logger: the same line a C message gets
+	FILE * f = std::tmpfile();
+	mulog_ref l;
+	char line[256];
+	mulog_create_file(&l, f, mulog_tm_fixed, 1);
+	{
+		CLogger log(l);
+		LoggerBase::Scope scope("req", "7");
+		log.format(Severity::Error, MULOG_FMT("{} of {} {}% done"), 3, 4, std::string("jobs"));
+		log.issue(Severity::Debug, "percent %d stays literal");
+	}
+	mulog_destroy(l);
+	std::rewind(f);
+	const char * want[] = { " ERROR: req=7 3 of 4 jobs% done\n", " DEBUG: req=7 percent %d stays literal\n" };
+	for(const char * w : want) {
+		const char * rest = std::fgets(line, sizeof(line), f) ? std::strchr(line, ']') : nullptr;
+		expect("CLogger line", rest ? rest + 1 : "<missing>", w);
+	}
+	std::fclose(f);
+
+	// through a C column logger: each format() call site is its own category, and the context
+	// is kept apart from the message
+	f = std::tmpfile();
+	mulog_create_col(&l, f, 16, 1);
+	{
+		CLogger log(l);
+		LoggerBase::Scope scope("req", "7");
+		for(int i = 0; i < 2; ++i) {
+			log.format(Severity::Info, MULOG_FMT("first {}"), i);
+			log.format(Severity::Info, MULOG_FMT("second {}"), i);
+		}
+		log.info(std::string("plain"));
+	}
+	mulog_destroy(l);
+	std::vector<char> cbuf(static_cast<std::size_t>(std::ftell(f)));
+	std::rewind(f);
+	std::size_t pos = 0;
+	const char * seg = std::fread(cbuf.data(), 1, cbuf.size(), f) == cbuf.size() ? mulog_col_next(cbuf.data(), cbuf.size(), &pos) : nullptr;
+	const char * wantcat[] = { "first {}", "second {}", "first {}", "second {}", "%.*s" };
+	const char * wantpay[] = { "first 0", "second 0", "first 1", "second 1", "plain" };
+	if(!seg || mulog_col_footer_of(seg)->count != 5 || mulog_col_footer_of(seg)->dict_count != 3) {
+		fail("CLogger column segment", seg ? std::to_string(mulog_col_footer_of(seg)->dict_count) : "<missing>", "3 categories");
+	} else {
+		for(uint32_t i = 0; i < 5; ++i) {
+			std::size_t len, clen;
+			const char * pay = mulog_col_payload(seg, i, &len);
+			const char * ctx = mulog_col_context(seg, i, &clen);
+			const char * cat = mulog_col_category(seg, mulog_col_cats(seg)[i]);
+			expect("CLogger column category", cat ? cat : "<missing>", wantcat[i]);
+			expect("CLogger column payload", std::string(pay, len), wantpay[i]);
+			expect("CLogger column context", std::string(ctx, clen), "req=7");
+		}
+	}
+	std::fclose(f);
+	std::printf("format: done\n");
+}
+
+// Logs every kind of C++ message through a CLogger; in testcxx_na the second pass must not allocate
+void test_noalloc() {
+	FILE * f = std::tmpfile();
+	mulog_ref l;
+	const std::string str("std::string message");
+	const std::string big(1000, 'x');           // more than a record, less than a large buffer
+	const std::wstring wide(L"wide message \u00e9\u4e2d\U0001F600");
+#if MULOG_FEATURE_QT
+	const QString qstr(QString::fromUtf8("Qt message \xc3\xa9"));
+#endif
+	unsigned long allocs = 0;
+
+	mulog_create_file(&l, f, mulog_tm_fixed, 1);
+	{
+		CLogger log(l);
+		for(int pass = 0; pass < 2; ++pass) {
+#ifdef MULOG_TEST_NOALLOC
+			na_armed = pass == 1;
+#endif
+			LoggerBase::Scope scope("req", "7");
+			log.info(str);
+			log.err(str);
+			log.warn(big);
+			log.info(wide);
+#if MULOG_FEATURE_QT
+			log.info(qstr);
+#endif
+			log.issue(Severity::Debug, "literal");
+			log.format(Severity::Info, MULOG_FMT("{} from {} sent {} bytes ({})"), pass, str, 1234567890123ull, 0.5);
+			log.format(Severity::Critical, MULOG_FMT("{}: {}"), "large", big);
+#ifdef MULOG_TEST_NOALLOC
+			na_armed = false;
+			allocs = na_count;
+#endif
+		}
+	}
+	mulog_destroy(l);
+	std::fclose(f);
+	if(allocs) {
+		std::printf("FAIL %lu heap allocation(s) while logging\n", allocs);
+		failures++;
+	}
+	std::printf("noalloc: done\n");
+}
+
+// Checks that backtraces of C++ messages start at the caller, not in CLogger or the C logger
+void test_trace() {
+	FILE * f = std::tmpfile();
+	mulog_ref l;
+	mulog_create_file(&l, f, mulog_tm_fixed, 0);
+	if(mulog_trace_start(4, f) == mulog_ok) {
+		const char * want[] = { "(trace_string+", "(trace_wide+", "(trace_format+" };
+		const std::size_t count = sizeof(want) / sizeof(want[0]);
+		char line[512];
+		std::size_t top = 0;
+		{
+			CLogger log(l);
+			trace_string(log);
+			trace_wide(log);
+			trace_format(log);
+		}
+		mulog_trace_stop();
+		std::rewind(f);
+		// the innermost frame of each symbolized trace
+		while(std::fgets(line, sizeof(line), f)) {
+			if(std::strncmp(line, "[bt=", 4) || !std::strstr(line, "] #0 ")) continue;
+			if(top >= count || !std::strstr(line, want[top])) fail("backtrace start", line, top < count ? want[top] : "");
+			top++;
+		}
+		if(top != count) fail("backtrace count", std::to_string(top), std::to_string(count).c_str());
+	}
+	mulog_destroy(l);
+	std::fclose(f);
+	std::printf("trace: done\n");
+}
+
+} // namespace
+
+int main(int argc, char ** argv) {
+	if(argc > 1) rng_state = std::strtoull(argv[1], nullptr, 0) | 1;
+	mulog_pool_init(256, 32, 4, 4096, 2);
+
+	test_transcode(20000);
+	test_format();
+	test_noalloc();
+	test_trace();
+
+	if(failures) std::printf("%d check(s) failed\n", failures);
+	return failures ? 1 : 0;
+}